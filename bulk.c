@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bulk.h"
+#include "daemon.h"
+#include "reduce.h"
+#include "parse_int.h"
+
+typedef struct {
+    size_t start;      // Byte offset (text) or pair index (binary)
+    size_t end;
+    size_t out_index;  // First result slot of this slice
+    size_t pairs;      // Results this slice produces
+    size_t malformed;  // Text lines that did not hold two integers
+    size_t bad_line;   // Line number of the first such line, from 1
+    size_t bad_byte;   // Byte offset in the file of the token it failed on
+    int bad_reason;    // parse_int32() error for it
+} bulk_slice;
+
+// State shared by the bulk workers, set up before they are forked
+static const char *in_map = NULL;
+static size_t in_size = 0;
+static int *out_map = NULL;
+static bulk_slice *slices = NULL;  // MAP_SHARED, workers report back here
+
+void compare_batch(const int *pairs, size_t n, int *out) {
+    for (size_t i = 0; i < n; i++) {
+        int a = pairs[2 * i], b = pairs[2 * i + 1];
+        out[i] = a > b ? a : b;
+    }
+}
+
+static int is_binary(const char *path) {
+    size_t len = strlen(path);
+    return len >= 4 && strcmp(path + len - 4, ".bin") == 0;
+}
+
+static size_t count_lines(const char *p, size_t len) {
+    size_t lines = 0;
+    const char *end = p + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        lines++;
+        if (nl == NULL) break;
+        p = nl + 1;
+    }
+    return lines;
+}
+
+static void count_slice(int index) {
+    bulk_slice *s = &slices[index];
+    s->pairs = count_lines(in_map + s->start, s->end - s->start);
+}
+
+static void convert_text_slice(int index) {
+    bulk_slice *s = &slices[index];
+    const char *p = in_map + s->start;
+    const char *end = in_map + s->end;
+    int *out = out_map + s->out_index;
+    int batch[2 * BULK_BATCH];
+    size_t n = 0;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+
+        // Exactly two integers per line, nothing else but blanks
+        const char *q = p;
+        int rc = parse_int32(&q, line_end, 0, &batch[2 * n]);
+        if (rc == PARSE_OK) rc = parse_int32(&q, line_end, 0, &batch[2 * n + 1]);
+        while (rc == PARSE_OK && q < line_end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+        if (rc == PARSE_OK && q != line_end) rc = PARSE_INVALID;
+        if (rc != PARSE_OK) {
+            if (s->malformed++ == 0) {
+                while (q < line_end && (*q == ' ' || *q == '\t')) q++;
+                s->bad_line = (size_t)(out - out_map) + n + 1;  // One result slot per line
+                s->bad_byte = (size_t)(q - in_map);
+                s->bad_reason = rc;
+            }
+            batch[2 * n] = batch[2 * n + 1] = 0;
+        }
+        if (++n == BULK_BATCH) {
+            compare_batch(batch, n, out);
+            out += n;
+            n = 0;
+        }
+        p = line_end + 1;
+    }
+    compare_batch(batch, n, out);
+}
+
+static void convert_binary_slice(int index) {
+    bulk_slice *s = &slices[index];
+    const int *in = (const int *)in_map;
+    for (size_t i = s->start; i < s->end; i += BULK_BATCH) {
+        size_t n = s->end - i < BULK_BATCH ? s->end - i : BULK_BATCH;
+        compare_batch(in + 2 * i, n, out_map + i);
+    }
+}
+
+// Fork one pinned worker per slice running fn, wait for all of them
+static int run_workers(int workers, void (*fn)(int)) {
+    pid_t pids[BULK_MAX_WORKERS];
+    int failed = 0;
+
+    for (int i = 0; i < workers; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            reduce_pin_worker(i);
+            fn(i);
+            PROFILE_DUMP();
+            _exit(EXIT_SUCCESS);
+        } else if (pids[i] == -1) {
+            fprintf(stderr, "fork failed for bulk worker %d\n", i);
+            failed = 1;
+            workers = i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed = 1;
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+// Cut text input into per-worker slices that start on line boundaries
+static void split_text(int workers) {
+    size_t prev = 0;
+    for (int i = 0; i < workers; i++) {
+        size_t end = in_size;
+        if (i + 1 < workers) {
+            end = in_size / workers * (i + 1);
+            if (end < prev) end = prev;
+            const char *nl = memchr(in_map + end, '\n', in_size - end);
+            end = nl ? (size_t)(nl - in_map) + 1 : in_size;
+        }
+        slices[i].start = prev;
+        slices[i].end = end;
+        prev = end;
+    }
+}
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_bulk(const bulk_config *cfg) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int binary = is_binary(cfg->input);
+    int workers = cfg->workers < 1 ? 1 : cfg->workers;
+    if (workers > BULK_MAX_WORKERS) workers = BULK_MAX_WORKERS;
+
+    int in_fd = open(cfg->input, O_RDONLY);
+    struct stat st;
+    if (in_fd == -1 || fstat(in_fd, &st) == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", cfg->input, strerror(errno));
+        return -1;
+    }
+    in_size = (size_t)st.st_size;
+    if (binary && in_size % (2 * sizeof(int)) != 0) {
+        fprintf(stderr, "%s: size is not a whole number of int32 pairs\n", cfg->input);
+        close(in_fd);
+        return -1;
+    }
+
+    if (in_size > 0) {
+        in_map = mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if (in_map == MAP_FAILED) {
+            fprintf(stderr, "mmap %s failed: %s\n", cfg->input, strerror(errno));
+            close(in_fd);
+            return -1;
+        }
+        madvise((void *)in_map, in_size, MADV_SEQUENTIAL);
+    }
+    close(in_fd);
+
+    slices = mmap(NULL, BULK_MAX_WORKERS * sizeof(bulk_slice), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slices == MAP_FAILED) {
+        fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Work out how many results each slice produces and where they go
+    size_t total = 0;
+    if (binary) {
+        size_t n_pairs = in_size / (2 * sizeof(int));
+        for (int i = 0; i < workers; i++) {
+            slices[i].start = n_pairs / workers * i;
+            slices[i].end = i + 1 < workers ? n_pairs / workers * (i + 1) : n_pairs;
+            slices[i].pairs = slices[i].end - slices[i].start;
+        }
+    } else {
+        split_text(workers);
+        if (in_size > 0 && run_workers(workers, count_slice) == -1) return -1;
+    }
+    for (int i = 0; i < workers; i++) {
+        slices[i].out_index = total;
+        total += slices[i].pairs;
+    }
+
+    int out_fd = open(cfg->output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1 || ftruncate(out_fd, total * sizeof(int)) == -1) {
+        fprintf(stderr, "Cannot create %s: %s\n", cfg->output, strerror(errno));
+        return -1;
+    }
+    if (total > 0) {
+        out_map = mmap(NULL, total * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if (out_map == MAP_FAILED) {
+            fprintf(stderr, "mmap %s failed: %s\n", cfg->output, strerror(errno));
+            close(out_fd);
+            return -1;
+        }
+        madvise(out_map, total * sizeof(int), MADV_SEQUENTIAL);
+
+        if (run_workers(workers, binary ? convert_binary_slice : convert_text_slice) == -1) {
+            fprintf(stderr, "A bulk worker failed\n");
+            return -1;
+        }
+        munmap(out_map, total * sizeof(int));
+    }
+    close(out_fd);
+    if (in_size > 0) munmap((void *)in_map, in_size);
+
+    // Malformed lines fail the whole job rather than leaving zeros behind
+    size_t malformed = 0;
+    for (int i = 0; i < workers; i++) {
+        if (slices[i].malformed && malformed == 0) {
+            fprintf(stderr, "%s: line %zu, byte %zu: %s\n", cfg->input, slices[i].bad_line,
+                    slices[i].bad_byte, parse_strerror(slices[i].bad_reason));
+        }
+        malformed += slices[i].malformed;
+    }
+    munmap(slices, BULK_MAX_WORKERS * sizeof(bulk_slice));
+    if (malformed) {
+        fprintf(stderr, "Rejected %s: %zu malformed lines\n", cfg->input, malformed);
+        unlink(cfg->output);
+        return -1;
+    }
+
+    double secs = elapsed_since(&start);
+    double bytes = (double)in_size + (double)total * sizeof(int);
+    printf("Bulk: %zu pairs with %d workers in %.3f s\n", total, workers, secs);
+    printf("Bulk: %.2f GB/s end to end (%.0f MB in+out), %.1f M pairs/s\n",
+           secs > 0 ? bytes / secs / 1e9 : 0.0, bytes / 1e6,
+           secs > 0 ? total / secs / 1e6 : 0.0);
+    return 0;
+}
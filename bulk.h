@@ -0,0 +1,29 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include <stddef.h>
+
+// Offline bulk mode: the input file is memory-mapped and split into one
+// slice per worker process, each pushing its pairs through the compare
+// stage in batches and storing the results straight into a memory-mapped
+// output file of native int32 values, one per input pair.
+//
+// Input ending in ".bin" holds native int32 pairs; anything else is text
+// with one "<num1> <num2>" pair per line; any malformed line rejects the job.
+
+#define BULK_BATCH 4096        // Pairs compared per batch
+#define BULK_MAX_WORKERS 8
+
+typedef struct {
+    const char *input;
+    const char *output;
+    int workers;
+} bulk_config;
+
+// Returns 0 and prints a throughput report, or -1 on error
+int run_bulk(const bulk_config *cfg);
+
+// The compare stage over n pairs: out[i] = max(pairs[2i], pairs[2i+1])
+void compare_batch(const int *pairs, size_t n, int *out);
+
+#endif
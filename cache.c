@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "cache.h"
+
+enum { ENTRY_EMPTY = 0, ENTRY_PENDING = 1, ENTRY_READY = 2 };
+
+#define WAITERS_BIT (1ULL << 40)
+#define TAG_MASK ((1u << 23) - 1)
+
+static int32_t word_value(unsigned long long w) { return (int32_t)(uint32_t)w; }
+static unsigned word_state(unsigned long long w) { return (unsigned)(w >> 32) & 0xFF; }
+static uint32_t word_tag(unsigned long long w) { return (uint32_t)(w >> 41); }
+
+static unsigned long long make_word(uint32_t tag, unsigned state, int32_t value) {
+    return ((unsigned long long)(tag & TAG_MASK) << 41) |
+           ((unsigned long long)state << 32) | (uint32_t)value;
+}
+
+// Bookkeeping private to the daemon: only it claims, sweeps and parks.
+// Workers reach the entries through their mapping of the shared memfd;
+// these statics stay behind (blank after exec, a stale copy under -p fork)
+// and are never touched there.
+static unsigned char referenced[CACHE_SLOTS];
+static unsigned char clock_hand[CACHE_SETS];
+static long long claimed_at[CACHE_SLOTS];
+static int waiter_head[CACHE_SLOTS];          // First parked waiter, -1 if none
+static cache_waiter waiters[CACHE_MAX_WAITERS];
+static int waiter_next[CACHE_MAX_WAITERS];    // Next on the same entry, or free list
+static int free_waiter;
+static int watched[CACHE_MAX_WAITERS];        // Entries with parked waiters
+static int n_watched;
+static uint32_t next_tag;
+static cache_stats stats;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static cache_entry *entry_at(result_cache *c, int slot) {
+    return &c->sets[slot / CACHE_WAYS].ways[slot % CACHE_WAYS];
+}
+
+static unsigned set_of(int32_t lo, int32_t hi) {
+    uint64_t k = ((uint64_t)(uint32_t)lo << 32) | (uint32_t)hi;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return (unsigned)k & (CACHE_SETS - 1);
+}
+
+void cache_init(result_cache *c) {
+    for (int slot = 0; slot < CACHE_SLOTS; slot++) {
+        atomic_init(&entry_at(c, slot)->word, make_word(0, ENTRY_EMPTY, 0));
+        waiter_head[slot] = -1;
+    }
+    for (int i = 0; i < CACHE_MAX_WAITERS; i++) {
+        waiter_next[i] = i + 1 < CACHE_MAX_WAITERS ? i + 1 : -1;
+    }
+    free_waiter = 0;
+    n_watched = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+static void park(int slot, const cache_waiter *who) {
+    int w = free_waiter;
+    free_waiter = waiter_next[w];
+    waiters[w] = *who;
+    waiter_next[w] = waiter_head[slot];
+    waiter_head[slot] = w;
+    stats.waiting++;
+}
+
+// Pick a READY entry not referenced since the last sweep, or a claim that
+// was abandoned without waiters. Never one with waiters still parked: the
+// published word no longer flags them, but until cache_collect() answers
+// them they expect this entry's value, not the next key's. Returns the
+// way, or -1.
+static int pick_victim(result_cache *c, unsigned set, long long now) {
+    cache_set *s = &c->sets[set];
+    int base = (int)set * CACHE_WAYS;
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (waiter_head[base + i] == -1 && word_state(atomic_load(&s->ways[i].word)) == ENTRY_EMPTY) {
+            return i;
+        }
+    }
+    for (int n = 0; n < 2 * CACHE_WAYS; n++) {
+        int i = clock_hand[set];
+        clock_hand[set] = (unsigned char)((i + 1) % CACHE_WAYS);
+        int slot = base + i;
+        if (waiter_head[slot] != -1) continue;
+        unsigned long long w = atomic_load(&s->ways[i].word);
+
+        if (word_state(w) == ENTRY_READY) {
+            if (!referenced[slot]) return i;
+            referenced[slot] = 0;
+        } else if (!(w & WAITERS_BIT) && now - claimed_at[slot] > CACHE_PENDING_MS) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int cache_begin(result_cache *c, const int nums[2], const cache_waiter *who,
+                int *value, cache_ticket *ticket) {
+    // max() is symmetric, so (a, b) and (b, a) share an entry
+    int32_t lo = nums[0] < nums[1] ? nums[0] : nums[1];
+    int32_t hi = nums[0] < nums[1] ? nums[1] : nums[0];
+    unsigned set = set_of(lo, hi);
+    cache_set *s = &c->sets[set];
+    ticket->slot = -1;
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        cache_entry *e = &s->ways[i];
+        int slot = (int)set * CACHE_WAYS + i;
+        unsigned long long w = atomic_load_explicit(&e->word, memory_order_acquire);
+        if (word_state(w) == ENTRY_EMPTY || e->key[0] != lo || e->key[1] != hi) continue;
+
+        if (word_state(w) == ENTRY_PENDING) {
+            if (free_waiter == -1) {
+                stats.bypassed++;
+                return CACHE_BYPASS;
+            }
+            // Flag the entry so the worker publishing it wakes us; if it
+            // published in the meantime the CAS fails and we have a hit
+            if (!(w & WAITERS_BIT) &&
+                atomic_compare_exchange_strong(&e->word, &w, w | WAITERS_BIT)) {
+                watched[n_watched++] = slot;
+            }
+            if (word_state(w) == ENTRY_PENDING) {
+                park(slot, who);
+                stats.coalesced++;
+                return CACHE_COALESCED;
+            }
+        }
+        referenced[slot] = 1;
+        *value = word_value(w);
+        stats.hits++;
+        return CACHE_HIT;
+    }
+
+    long long now = now_ms();
+    int way = pick_victim(c, set, now);
+    if (way == -1) {
+        stats.bypassed++;
+        return CACHE_BYPASS;
+    }
+
+    cache_entry *e = &s->ways[way];
+    int slot = (int)set * CACHE_WAYS + way;
+    uint32_t tag = next_tag++ & TAG_MASK;
+    unsigned long long old = atomic_load(&e->word);
+    if (!atomic_compare_exchange_strong(&e->word, &old, make_word(tag, ENTRY_PENDING, 0))) {
+        stats.bypassed++;  // A late worker just published into the victim
+        return CACHE_BYPASS;
+    }
+    if (word_state(old) == ENTRY_READY) stats.evictions++;
+    if (word_state(old) == ENTRY_PENDING) stats.abandoned++;
+
+    e->key[0] = lo;
+    e->key[1] = hi;
+    referenced[slot] = 1;
+    claimed_at[slot] = now;
+    ticket->slot = slot;
+    ticket->tag = tag;
+    stats.misses++;
+    return CACHE_MISS;
+}
+
+static void release_waiters(int slot, cache_answer_fn answer, void *arg, int status, int value) {
+    int w = waiter_head[slot];
+    while (w != -1) {
+        int next = waiter_next[w];
+        answer(arg, &waiters[w], status, value);
+        waiter_next[w] = free_waiter;
+        free_waiter = w;
+        stats.waiting--;
+        w = next;
+    }
+    waiter_head[slot] = -1;
+}
+
+int cache_collect(result_cache *c, cache_answer_fn answer, void *arg) {
+    int before = stats.waiting;
+    long long now = now_ms();
+
+    for (int i = 0; i < n_watched;) {
+        int slot = watched[i];
+        cache_entry *e = entry_at(c, slot);
+        unsigned long long w = atomic_load_explicit(&e->word, memory_order_acquire);
+
+        if (word_state(w) == ENTRY_READY) {
+            release_waiters(slot, answer, arg, 0, word_value(w));
+        } else if (now - claimed_at[slot] > CACHE_PENDING_MS &&
+                   atomic_compare_exchange_strong(&e->word, &w, make_word(0, ENTRY_EMPTY, 0))) {
+            // The worker never answered, probably died: retry the waiters
+            stats.abandoned++;
+            release_waiters(slot, answer, arg, -1, 0);
+        } else {
+            i++;
+            continue;
+        }
+        watched[i] = watched[--n_watched];
+    }
+    return before - stats.waiting;
+}
+
+cache_stats cache_get_stats(void) {
+    return stats;
+}
+
+int cache_complete(result_cache *c, const cache_ticket *ticket, int value) {
+    if (ticket->slot < 0) return 0;
+    cache_entry *e = entry_at(c, ticket->slot);
+    unsigned long long w = atomic_load(&e->word);
+    for (;;) {
+        if (word_tag(w) != ticket->tag || word_state(w) != ENTRY_PENDING) return 0;  // Reused
+        if (atomic_compare_exchange_weak_explicit(&e->word, &w,
+                                                  make_word(ticket->tag, ENTRY_READY, value),
+                                                  memory_order_release, memory_order_relaxed)) {
+            return (w & WAITERS_BIT) != 0;
+        }
+    }
+}
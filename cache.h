@@ -0,0 +1,86 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Result cache of the server, keyed by request content. It lives in the
+// shared mapping: the daemon looks requests up and claims entries, compare
+// workers publish results into the entries they were handed. Sets of
+// CACHE_WAYS entries fill exactly one cache line, so a lookup touches one
+// line; a CLOCK sweep inside the set picks the victim.
+//
+// A request whose key is already being computed does not reach the
+// workers: it is parked as a waiter on the entry and answered by the daemon
+// once the result is published.
+
+#define CACHE_WAYS 4
+#define CACHE_SETS 16384            // Power of two
+#define CACHE_SLOTS (CACHE_SETS * CACHE_WAYS)
+#define CACHE_MAX_WAITERS 4096      // Coalesced requests parked at once
+#define CACHE_PENDING_MS 5000       // A claim older than this is abandoned
+
+typedef struct {
+    // tag:23 | waiters:1 | state:8 | value:32, updated with CAS so a late
+    // worker can never publish into an entry that was reused
+    atomic_ullong word;
+    int32_t key[2];                 // Written and read by the daemon only
+} cache_entry;
+
+typedef struct {
+    _Alignas(64) cache_entry ways[CACHE_WAYS];
+} cache_set;
+
+typedef struct {
+    cache_set sets[CACHE_SETS];
+} result_cache;
+
+// Handed to the worker that computes a claimed entry
+typedef struct {
+    int32_t slot;                   // -1: not cached
+    uint32_t tag;
+} cache_ticket;
+
+typedef struct {
+    pid_t client;
+    uint32_t request_id;
+    int32_t nums[2];                // The key, for whoever reports the answer
+} cache_waiter;
+
+enum {
+    CACHE_HIT,        // *value holds the answer
+    CACHE_MISS,       // Entry claimed; dispatch with the ticket
+    CACHE_COALESCED,  // Parked behind an identical request in flight
+    CACHE_BYPASS      // No room; dispatch without caching
+};
+
+typedef struct {
+    long hits;
+    long misses;
+    long coalesced;
+    long bypassed;
+    long evictions;
+    long abandoned;
+    int waiting;      // Waiters parked right now
+} cache_stats;
+
+void cache_init(result_cache *c);
+
+// Daemon side
+int cache_begin(result_cache *c, const int nums[2], const cache_waiter *who,
+                int *value, cache_ticket *ticket);
+
+// Hand every parked waiter whose entry completed to answer() with status
+// 0 and the value. Waiters of abandoned claims get status -1 and must be
+// dispatched again. Returns the number of waiters handed out.
+typedef void (*cache_answer_fn)(void *arg, const cache_waiter *w, int status, int value);
+int cache_collect(result_cache *c, cache_answer_fn answer, void *arg);
+
+cache_stats cache_get_stats(void);
+
+// Worker side: publish the value of a claimed entry. Returns 1 when
+// waiters are parked on it and the daemon should be woken.
+int cache_complete(result_cache *c, const cache_ticket *ticket, int value);
+
+#endif
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "cache.h"
+
+// Checks of the result cache run by make test. Coalesced waiters stay
+// parked after their entry is published, until cache_collect(); the set
+// they sit in must not hand their entry to another key meanwhile.
+
+#define SAME_SET_KEYS (4 * CACHE_WAYS)
+
+static result_cache cache;   // Too large for the stack
+static int failures = 0;
+static int answered = 0;
+
+static int larger(int a, int b) {
+    return a > b ? a : b;
+}
+
+static void check_answer(void *arg, const cache_waiter *w, int status, int value) {
+    (void)arg;
+    answered++;
+    if (status != 0 || value != larger(w->nums[0], w->nums[1])) {
+        printf("FAIL waiter for (%d,%d) answered %d, status %d\n", w->nums[0], w->nums[1],
+               value, status);
+        failures++;
+    }
+}
+
+// Keys landing in the same set as (0,1), learned from the slots the cache
+// hands out; every claim is published at once so the set keeps turning over
+static int same_set_keys(int keys[][2], int want) {
+    int nums[2] = { 0, 1 }, value, n = 0;
+    cache_ticket t;
+    cache_waiter who = { 0, 0, { 0, 0 } };
+    cache_init(&cache);
+    if (cache_begin(&cache, nums, &who, &value, &t) != CACHE_MISS) return 0;
+    int set = t.slot / CACHE_WAYS;
+    cache_complete(&cache, &t, 1);
+
+    for (int k = 2; k < 1000000 && n < want; k++) {
+        nums[1] = k;
+        if (cache_begin(&cache, nums, &who, &value, &t) != CACHE_MISS) continue;
+        if (t.slot / CACHE_WAYS == set) {
+            keys[n][0] = 0;
+            keys[n][1] = k;
+            n++;
+        }
+        cache_complete(&cache, &t, k);
+    }
+    return n;
+}
+
+static void test_parked_waiters_keep_their_entry(void) {
+    int keys[SAME_SET_KEYS][2], value;
+    if (same_set_keys(keys, SAME_SET_KEYS) < SAME_SET_KEYS) {
+        printf("FAIL no %d keys sharing a set\n", SAME_SET_KEYS);
+        failures++;
+        return;
+    }
+
+    // (0,1) computed once with a second request parked behind it
+    cache_init(&cache);
+    int first[2] = { 0, 1 };
+    cache_ticket t, other;
+    cache_waiter who = { 100, 1, { 0, 1 } };
+    if (cache_begin(&cache, first, &who, &value, &t) != CACHE_MISS ||
+        cache_begin(&cache, first, &who, &value, &other) != CACHE_COALESCED) {
+        printf("FAIL (0,1) was not claimed and coalesced\n");
+        failures++;
+        return;
+    }
+    cache_complete(&cache, &t, 1);
+
+    // Published but not collected yet: the rest of the set goes through
+    // misses, each published with its own result
+    for (int i = 0; i < SAME_SET_KEYS; i++) {
+        who.request_id = (uint32_t)(2 + i);
+        who.nums[0] = keys[i][0];
+        who.nums[1] = keys[i][1];
+        int rc = cache_begin(&cache, keys[i], &who, &value, &t);
+        if (rc == CACHE_MISS) {
+            cache_complete(&cache, &t, larger(keys[i][0], keys[i][1]));
+        } else if (rc == CACHE_HIT && value != larger(keys[i][0], keys[i][1])) {
+            printf("FAIL (%d,%d) hit %d\n", keys[i][0], keys[i][1], value);
+            failures++;
+        }
+    }
+
+    cache_collect(&cache, check_answer, NULL);
+    if (answered != 1) {
+        printf("FAIL %d waiters answered, expected 1\n", answered);
+        failures++;
+    }
+}
+
+int main(void) {
+    test_parked_waiters_keep_their_entry();
+    printf("%s\n", failures ? "cache_test FAILED" : "cache_test passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+static const char *capture_path = NULL;
+static int capture_fd = -1;
+static unsigned char *base = NULL;   // Mapping of the whole file, header first
+static size_t mapped = 0;
+
+static capture_header *header(void) {
+    return (capture_header *)base;
+}
+
+static size_t used_bytes(void) {
+    return sizeof(capture_header) + header()->records * sizeof(capture_record);
+}
+
+// Reserve the blocks before the mapping reaches them: a full disk then
+// fails here instead of raising SIGBUS on the next record
+static int grow(void) {
+    if (mapped + CAPTURE_GROW > CAPTURE_MAX_BYTES) return -1;
+    if (posix_fallocate(capture_fd, (off_t)mapped, CAPTURE_GROW) != 0) return -1;
+    void *m = mremap(base, mapped, mapped + CAPTURE_GROW, MREMAP_MAYMOVE);
+    if (m == MAP_FAILED) return -1;
+    base = m;
+    mapped += CAPTURE_GROW;
+    return 0;
+}
+
+int capture_open(const char *path) {
+    capture_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture_fd == -1) return -1;
+    int rc = posix_fallocate(capture_fd, 0, CAPTURE_GROW);
+    if (rc != 0) {
+        close(capture_fd);
+        capture_fd = -1;
+        errno = rc;
+        return -1;
+    }
+    void *m = mmap(NULL, CAPTURE_GROW, PROT_READ | PROT_WRITE, MAP_SHARED, capture_fd, 0);
+    if (m == MAP_FAILED) {
+        close(capture_fd);
+        capture_fd = -1;
+        return -1;
+    }
+    base = m;
+    mapped = CAPTURE_GROW;
+    capture_path = path;
+
+    capture_header *h = header();
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(h->magic));
+    h->version = CAPTURE_VERSION;
+    h->record_size = sizeof(capture_record);
+    h->start_ns = wire_now_ns();
+    h->start_unix = (uint64_t)time(NULL);
+    h->records = 0;
+    h->dropped = 0;
+    return 0;
+}
+
+void capture_request(const wire_header *hdr, const wire_compare *cmp, uint64_t now_ns) {
+    if (base == NULL) return;
+    if (used_bytes() + sizeof(capture_record) > mapped && grow() == -1) {
+        header()->dropped++;
+        return;
+    }
+
+    capture_header *h = header();
+    capture_record *rec = (capture_record *)(base + used_bytes());
+    rec->ns = now_ns - h->start_ns;
+    rec->client = hdr->client;
+    rec->request_id = hdr->request_id;
+    rec->nums[0] = cmp->nums[0];
+    rec->nums[1] = cmp->nums[1];
+    rec->timeout_us = 0;
+    if (hdr->deadline_ns != 0) {
+        uint64_t left_us = hdr->deadline_ns > now_ns ? (hdr->deadline_ns - now_ns) / 1000 : 0;
+        rec->timeout_us = left_us == 0 ? 1 : left_us > UINT32_MAX ? UINT32_MAX : (uint32_t)left_us;
+    }
+    rec->flags = hdr->flags;
+    rec->reserved = 0;
+    h->records++;  // Only now, so a reader never sees half a record
+}
+
+void capture_close(void) {
+    if (base == NULL) return;
+    size_t used = used_bytes();
+    munmap(base, mapped);
+    base = NULL;
+    mapped = 0;
+    if (ftruncate(capture_fd, (off_t)used) == -1) {
+        fprintf(stderr, "Cannot trim capture %s: %s\n", capture_path, strerror(errno));
+    }
+    close(capture_fd);
+    capture_fd = -1;
+}
+
+void capture_report(FILE *out) {
+    if (base == NULL) return;
+    const capture_header *h = header();
+    fprintf(out, "Capture %s: %llu requests (%.1f MB), %llu dropped at the %llu MB cap\n",
+            capture_path, (unsigned long long)h->records, used_bytes() / 1e6,
+            (unsigned long long)h->dropped, CAPTURE_MAX_BYTES >> 20);
+}
+
+int capture_map(const char *path, capture_trace *t) {
+    memset(t, 0, sizeof(*t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(capture_header)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        close(fd);
+        return -1;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    t->hdr = m;
+    t->size = (size_t)st.st_size;
+    if (memcmp(t->hdr->magic, CAPTURE_MAGIC, sizeof(t->hdr->magic)) != 0 ||
+        t->hdr->version != CAPTURE_VERSION || t->hdr->record_size != sizeof(capture_record)) {
+        fprintf(stderr, "%s: not a capture file of this version\n", path);
+        capture_unmap(t);
+        return -1;
+    }
+
+    // The count of a copy cut short runs past its end; trust only what fits
+    size_t fits = (t->size - sizeof(capture_header)) / sizeof(capture_record);
+    t->records = (const capture_record *)(t->hdr + 1);
+    t->count = t->hdr->records < fits ? (size_t)t->hdr->records : fits;
+    return 0;
+}
+
+void capture_unmap(capture_trace *t) {
+    if (t->hdr != NULL) munmap((void *)t->hdr, t->size);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,69 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "wire.h"
+
+// Traffic capture (-C <file>, server mode). The daemon appends one fixed
+// size record for every well-formed COMPARE frame it reads from FIFO1,
+// cached, coalesced and expired ones included, straight into a shared
+// mapping of the file: no system call per request, only an fallocate and
+// mremap whenever another CAPTURE_GROW bytes are needed. The header keeps
+// the count of complete records current, so the file stays readable even
+// when the daemon is killed. The replay tool sends a capture back through
+// a running server at its original pace, a multiple of it or flat out.
+
+#define CAPTURE_MAGIC "DLCAPTR1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_GROW (16u << 20)          // Bytes added to the file at a time
+#define CAPTURE_MAX_BYTES (1ull << 30)    // Requests beyond this are counted, not kept
+
+typedef struct {
+    char magic[8];          // CAPTURE_MAGIC
+    uint32_t version;
+    uint32_t record_size;   // sizeof(capture_record) of the writer
+    uint64_t start_ns;      // CLOCK_MONOTONIC when the capture began
+    uint64_t start_unix;    // Wall clock seconds at the same moment
+    uint64_t records;       // Complete records following the header
+    uint64_t dropped;       // Requests left out once the file reached its cap
+} capture_header;
+
+typedef struct {
+    uint64_t ns;            // Arrival, nanoseconds after start_ns
+    uint32_t client;        // PID of the sender
+    uint32_t request_id;
+    int32_t nums[2];
+    uint32_t timeout_us;    // Deadline left on arrival, 0: none (1 when already past)
+    uint16_t flags;         // Frame flags, the priority class among them
+    uint16_t reserved;
+} capture_record;
+
+// Daemon: create or replace the capture file. Returns 0, or -1 with errno
+// set; the server then does not start.
+int capture_open(const char *path);
+
+// Daemon: record a validated request read at now_ns (wire_now_ns). Does
+// nothing while capturing is off.
+void capture_request(const wire_header *hdr, const wire_compare *cmp, uint64_t now_ns);
+
+// Cut the file to the records written and release it
+void capture_close(void);
+
+// One line on the capture in progress, nothing when capturing is off
+void capture_report(FILE *out);
+
+// A capture file mapped read-only, for the replay tool
+typedef struct {
+    const capture_header *hdr;
+    const capture_record *records;
+    size_t count;
+    size_t size;            // Bytes mapped
+} capture_trace;
+
+// Returns 0, or -1 with a reason on stderr
+int capture_map(const char *path, capture_trace *t);
+void capture_unmap(capture_trace *t);
+
+#endif
@@ -0,0 +1,617 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "server.h"
+#include "client.h"
+#include "wire.h"
+#include "instance.h"
+
+typedef struct {
+    int used;
+    uint32_t id;
+    client_cb cb;
+    void *arg;
+    uint64_t deadline_ns;  // 0: none
+} pending_slot;
+
+struct client {
+    int req_fd;     // FIFO1, shared with every other client
+    int reply_fd;
+    int keep_fd;    // Our own write end keeps reply_fd from seeing EOF
+    daemon_instance inst;
+    char path[INSTANCE_PATH_MAX];
+    wire_reader in;
+    wire_writer out;
+    uint32_t next_id;
+    uint16_t priority;  // WIRE_PRIO_* stamped on every request
+    int deadline_ms;    // Relative deadline of new requests, 0 for none
+    uint64_t next_expiry_ns;  // No outstanding request expires before this, 0: none
+    long inflight;
+    pending_slot slots[CLIENT_MAX_INFLIGHT];
+};
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int remaining_ms(long long deadline) {
+    if (deadline < 0) return -1;
+    long long left = deadline - monotonic_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+static void complete(client *c, uint32_t id, int status, int larger) {
+    pending_slot *s = &c->slots[id & (CLIENT_MAX_INFLIGHT - 1)];
+    if (!s->used || s->id != id) return;  // Unknown or already abandoned
+    s->used = 0;
+    c->inflight--;
+    if (s->cb) s->cb(s->arg, status, larger);
+}
+
+// The caller stopped waiting for id: free its slot without a callback, so
+// later requests can use it and a late answer is dropped by complete()
+static void abandon(client *c, uint32_t id, const void *arg) {
+    pending_slot *s = &c->slots[id & (CLIENT_MAX_INFLIGHT - 1)];
+    if (!s->used || s->id != id || s->arg != arg) return;
+    s->used = 0;
+    c->inflight--;
+}
+
+// Complete the requests whose deadline passed with CLIENT_ERR_EXPIRED; the
+// server drops them too. Returns how many expired.
+static int expire_overdue(client *c) {
+    if (c->next_expiry_ns == 0) return 0;
+    uint64_t now = wire_now_ns();
+    if (now < c->next_expiry_ns) return 0;
+
+    int expired = 0;
+    uint64_t next = 0;
+    for (int i = 0; i < CLIENT_MAX_INFLIGHT; i++) {
+        pending_slot *s = &c->slots[i];
+        if (!s->used || s->deadline_ns == 0) continue;
+        if (wire_expired(s->deadline_ns, now)) {
+            complete(c, s->id, CLIENT_ERR_EXPIRED, 0);
+            expired++;
+        } else if (next == 0 || s->deadline_ns < next) {
+            next = s->deadline_ns;
+        }
+    }
+    c->next_expiry_ns = next;
+    return expired;
+}
+
+// Poll timeout that wakes up in time to expire the next request
+static int expiry_timeout(const client *c, int timeout) {
+    if (c->next_expiry_ns == 0) return timeout;
+    uint64_t now = wire_now_ns();
+    int until = c->next_expiry_ns > now ? (int)((c->next_expiry_ns - now + 999999) / 1000000) : 0;
+    return timeout < 0 || until < timeout ? until : timeout;
+}
+
+client *client_connect_to(const char *instance) {
+    client *c = calloc(1, sizeof(*c));
+    if (c == NULL) return NULL;
+    c->req_fd = c->reply_fd = c->keep_fd = -1;
+    c->next_id = 1;
+    if (instance_init(&c->inst, instance) == -1) {
+        fprintf(stderr, "Invalid instance name '%s'\n", instance);
+        free(c);
+        return NULL;
+    }
+
+    instance_reply_path(&c->inst, getpid(), c->path, sizeof(c->path));
+    unlink(c->path);
+    if (mkfifo(c->path, 0600) == -1) {
+        fprintf(stderr, "mkfifo %s failed: %s\n", c->path, strerror(errno));
+        free(c);
+        return NULL;
+    }
+
+    c->reply_fd = open(c->path, O_RDONLY | O_NONBLOCK);
+    c->keep_fd = open(c->path, O_WRONLY | O_NONBLOCK);
+    c->req_fd = open(c->inst.fifo1, O_WRONLY | O_NONBLOCK);
+    if (c->req_fd == -1) {
+        fprintf(stderr, "No server listening on %s\n", c->inst.fifo1);
+        client_close(c);
+        return NULL;
+    }
+    if (c->reply_fd == -1 || c->keep_fd == -1 ||
+        wire_reader_init(&c->in, c->reply_fd, SERVE_BATCH * (sizeof(wire_header) + sizeof(wire_result))) == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", c->path, strerror(errno));
+        client_close(c);
+        return NULL;
+    }
+    wire_writer_init(&c->out, c->req_fd, 1);
+    return c;
+}
+
+client *client_connect(void) {
+    return client_connect_to(NULL);
+}
+
+void client_close(client *c) {
+    if (c == NULL) return;
+    for (int i = 0; i < CLIENT_MAX_INFLIGHT && c->inflight > 0; i++) {
+        if (c->slots[i].used) complete(c, c->slots[i].id, CLIENT_ERR_IO, 0);
+    }
+    if (c->req_fd != -1) close(c->req_fd);
+    if (c->keep_fd != -1) close(c->keep_fd);
+    if (c->reply_fd != -1) close(c->reply_fd);
+    wire_reader_destroy(&c->in);
+    unlink(c->path);
+    free(c);
+}
+
+// Complete every whole frame already read. Returns how many completed.
+static int process_replies(client *c) {
+    wire_header hdr;
+    const void *payload;
+    int done = 0, rc;
+
+    while ((rc = wire_reader_peek(&c->in, &hdr, &payload)) != 0) {
+        if (rc == -1) continue;  // A corrupt frame names no request we could trust
+        wire_result res;
+        if (hdr.opcode == WIRE_OP_ERROR) {
+            complete(c, hdr.request_id, CLIENT_ERR_REJECTED, 0);
+        } else if (hdr.opcode == WIRE_OP_RESULT && hdr.length == sizeof(res)) {
+            memcpy(&res, payload, sizeof(res));
+            complete(c, hdr.request_id, CLIENT_OK, res.larger);
+        } else {
+            complete(c, hdr.request_id, CLIENT_ERR_PROTOCOL, 0);
+        }
+        wire_reader_consume(&c->in);
+        done++;
+    }
+    return done;
+}
+
+// Send the queued batch. While FIFO1 is full keep consuming replies, so a
+// server blocked on our reply FIFO can make progress.
+static int flush_until(client *c, long long deadline) {
+    while (wire_writer_pending(&c->out)) {
+        if (wire_writer_flush(&c->out) == 0) break;
+        if (errno != EAGAIN) return CLIENT_ERR_IO;
+
+        struct pollfd pfd[2] = {
+            { .fd = c->req_fd, .events = POLLOUT, .revents = 0 },
+            { .fd = c->reply_fd, .events = POLLIN, .revents = 0 },
+        };
+        int timeout = remaining_ms(deadline);
+        if (timeout == 0 || poll(pfd, 2, timeout) == 0) return CLIENT_ERR_TIMEOUT;
+        if (pfd[1].revents & POLLIN) {
+            wire_reader_fill(&c->in);
+            process_replies(c);
+        }
+    }
+    return CLIENT_OK;
+}
+
+int client_flush(client *c) {
+    return flush_until(c, monotonic_ms() + CLIENT_TIMEOUT_MS);
+}
+
+int client_poll(client *c, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    int rc = flush_until(c, deadline);
+    if (rc != CLIENT_OK) return rc;
+
+    int done = process_replies(c) + expire_overdue(c);
+    while (done == 0) {
+        struct pollfd pfd = { .fd = c->reply_fd, .events = POLLIN, .revents = 0 };
+        int n = poll(&pfd, 1, expiry_timeout(c, remaining_ms(deadline)));
+        if (n == -1 && errno != EINTR) return CLIENT_ERR_IO;
+        if (n <= 0) {
+            done = expire_overdue(c);
+            if (done == 0 && deadline >= 0 && remaining_ms(deadline) == 0) break;
+            continue;
+        }
+        if (wire_reader_fill(&c->in) == -1 && errno != EAGAIN) return CLIENT_ERR_IO;
+        done = process_replies(c) + expire_overdue(c);
+    }
+    return done;
+}
+
+long client_submit(client *c, int a, int b, client_cb cb, void *arg) {
+    uint32_t id = c->next_id;
+    pending_slot *s = &c->slots[id & (CLIENT_MAX_INFLIGHT - 1)];
+
+    // The slot still belongs to a request CLIENT_MAX_INFLIGHT IDs ago
+    long long deadline = monotonic_ms() + CLIENT_TIMEOUT_MS;
+    while (s->used) {
+        int rc = client_poll(c, remaining_ms(deadline));
+        if (rc < 0) return rc;
+        if (rc == 0 && remaining_ms(deadline) == 0) return CLIENT_ERR_TIMEOUT;
+    }
+
+    wire_compare cmp = { { a, b } };
+    wire_header hdr;
+    wire_header_init(&hdr, WIRE_OP_COMPARE, id, (uint32_t)getpid(), &cmp, sizeof(cmp));
+    if (c->priority != WIRE_PRIO_INTERACTIVE || c->deadline_ms > 0) {
+        hdr.flags = c->priority;
+        if (c->deadline_ms > 0) hdr.deadline_ns = wire_now_ns() + (uint64_t)c->deadline_ms * 1000000;
+        wire_header_seal(&hdr, &cmp);
+    }
+    while (wire_writer_append(&c->out, &hdr, &cmp) == -1) {
+        int rc = client_flush(c);
+        if (rc != CLIENT_OK) return rc;
+    }
+
+    s->used = 1;
+    s->id = id;
+    s->cb = cb;
+    s->arg = arg;
+    s->deadline_ns = hdr.deadline_ns;
+    if (hdr.deadline_ns && (c->next_expiry_ns == 0 || hdr.deadline_ns < c->next_expiry_ns)) {
+        c->next_expiry_ns = hdr.deadline_ns;
+    }
+    c->inflight++;
+    if (++c->next_id == 0) c->next_id = 1;
+    return (long)id;
+}
+
+int client_set_priority(client *c, int priority) {
+    if (priority < 0 || priority >= WIRE_PRIORITIES) return CLIENT_ERR_PROTOCOL;
+    c->priority = (uint16_t)priority;
+    return CLIENT_OK;
+}
+
+int client_set_deadline(client *c, int timeout_ms) {
+    if (timeout_ms < 0) return CLIENT_ERR_PROTOCOL;
+    c->deadline_ms = timeout_ms;
+    return CLIENT_OK;
+}
+
+static void future_done(void *arg, int status, int larger) {
+    client_future *f = arg;
+    f->status = status;
+    f->larger = larger;
+    f->done = 1;
+}
+
+long client_submit_future(client *c, int a, int b, client_future *f) {
+    f->done = 0;
+    f->status = CLIENT_OK;
+    f->larger = 0;
+    long id = client_submit(c, a, b, future_done, f);
+    f->id = id > 0 ? (uint32_t)id : 0;
+    return id;
+}
+
+int client_wait(client *c, client_future *f, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    while (!f->done) {
+        int rc = client_poll(c, remaining_ms(deadline));
+        if (rc < 0) return rc;
+        if (!f->done && deadline >= 0 && remaining_ms(deadline) == 0) {
+            abandon(c, f->id, f);  // A late answer must not write into f
+            return CLIENT_ERR_TIMEOUT;
+        }
+    }
+    return f->status;
+}
+
+int client_compare(client *c, int a, int b, int *larger) {
+    client_future f;
+    long id = client_submit_future(c, a, b, &f);
+    if (id < 0) return (int)id;
+    int rc = client_wait(c, &f, CLIENT_TIMEOUT_MS);
+    if (rc == CLIENT_OK) *larger = f.larger;
+    return rc;
+}
+
+int client_drain(client *c, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    while (c->inflight > 0) {
+        int rc = client_poll(c, remaining_ms(deadline));
+        if (rc < 0) return rc;
+        if (rc == 0 && deadline >= 0 && remaining_ms(deadline) == 0) return CLIENT_ERR_TIMEOUT;
+    }
+    return CLIENT_OK;
+}
+
+long client_inflight(const client *c) {
+    return c->inflight;
+}
+
+const char *client_strerror(int status) {
+    switch (status) {
+        case CLIENT_OK: return "ok";
+        case CLIENT_ERR_IO: return "server connection failed";
+        case CLIENT_ERR_TIMEOUT: return "no reply from server";
+        case CLIENT_ERR_REJECTED: return "server rejected the request";
+        case CLIENT_ERR_PROTOCOL: return "corrupt reply from server";
+        case CLIENT_ERR_EXPIRED: return "deadline passed before the answer";
+        default: return "unknown error";
+    }
+}
+
+typedef struct {
+    uint32_t hash;
+    int member;
+} ring_point;
+
+struct client_pool {
+    client *members[CLIENT_POOL_MAX];  // NULL for a free slot
+    char names[CLIENT_POOL_MAX][INSTANCE_NAME_MAX];
+    long routed[CLIENT_POOL_MAX];
+    int priority;
+    int deadline_ms;
+    ring_point ring[CLIENT_POOL_MAX * CLIENT_VNODES];
+    int n_points;
+};
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    // FNV alone clusters short keys; finish with a murmur3 mix
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int point_cmp(const void *a, const void *b) {
+    const ring_point *x = a, *y = b;
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+static void rebuild_ring(client_pool *p) {
+    p->n_points = 0;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m] == NULL) continue;
+        for (int v = 0; v < CLIENT_VNODES; v++) {
+            char point[INSTANCE_NAME_MAX + 16];
+            int len = snprintf(point, sizeof(point), "%s#%d", p->names[m], v);
+            p->ring[p->n_points].hash = hash_bytes(2166136261u, point, (size_t)len);
+            p->ring[p->n_points].member = m;
+            p->n_points++;
+        }
+    }
+    qsort(p->ring, (size_t)p->n_points, sizeof(ring_point), point_cmp);
+}
+
+// Member owning the first ring point at or after key
+static int route(const client_pool *p, uint32_t key) {
+    int lo = 0, hi = p->n_points;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (p->ring[mid].hash < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return p->ring[lo == p->n_points ? 0 : lo].member;
+}
+
+static int find_member(const client_pool *p, const char *instance) {
+    const char *name = instance ? instance : "";
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m] && strcmp(p->names[m], name) == 0) return m;
+    }
+    return -1;
+}
+
+// Forget a member without waiting; its requests fail with CLIENT_ERR_IO
+static void drop_member(client_pool *p, int m) {
+    client *c = p->members[m];
+    p->members[m] = NULL;
+    rebuild_ring(p);
+    client_close(c);
+}
+
+client_pool *client_pool_create(void) {
+    return calloc(1, sizeof(client_pool));
+}
+
+void client_pool_destroy(client_pool *p) {
+    if (p == NULL) return;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m]) client_close(p->members[m]);
+    }
+    free(p);
+}
+
+int client_pool_join(client_pool *p, const char *instance) {
+    if (find_member(p, instance) != -1) return 0;
+    int m = 0;
+    while (m < CLIENT_POOL_MAX && p->members[m] != NULL) m++;
+    if (m == CLIENT_POOL_MAX) return CLIENT_ERR_IO;
+
+    client *c = client_connect_to(instance);
+    if (c == NULL) return CLIENT_ERR_IO;
+    client_set_priority(c, p->priority);
+    client_set_deadline(c, p->deadline_ms);
+    p->members[m] = c;
+    snprintf(p->names[m], INSTANCE_NAME_MAX, "%s", instance ? instance : "");
+    p->routed[m] = 0;
+    rebuild_ring(p);
+    return 0;
+}
+
+int client_pool_set_priority(client_pool *p, int priority) {
+    if (priority < 0 || priority >= WIRE_PRIORITIES) return CLIENT_ERR_PROTOCOL;
+    p->priority = priority;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m]) client_set_priority(p->members[m], priority);
+    }
+    return CLIENT_OK;
+}
+
+int client_pool_set_deadline(client_pool *p, int timeout_ms) {
+    if (timeout_ms < 0) return CLIENT_ERR_PROTOCOL;
+    p->deadline_ms = timeout_ms;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m]) client_set_deadline(p->members[m], timeout_ms);
+    }
+    return CLIENT_OK;
+}
+
+int client_pool_leave(client_pool *p, const char *instance) {
+    int m = find_member(p, instance);
+    if (m == -1) return CLIENT_ERR_IO;
+
+    // Take it off the ring first so nothing new is routed there
+    client *c = p->members[m];
+    p->members[m] = NULL;
+    rebuild_ring(p);
+    int rc = client_drain(c, CLIENT_TIMEOUT_MS);
+    client_close(c);
+    return rc;
+}
+
+int client_pool_discover(client_pool *p) {
+    char names[CLIENT_POOL_MAX][INSTANCE_NAME_MAX];
+    int found = instance_discover(names, CLIENT_POOL_MAX);
+    int changes = 0;
+
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m] == NULL) continue;
+        int present = 0;
+        for (int i = 0; i < found && !present; i++) present = strcmp(names[i], p->names[m]) == 0;
+        if (!present) {
+            drop_member(p, m);
+            changes++;
+        }
+    }
+    for (int i = 0; i < found; i++) {
+        if (find_member(p, names[i]) == -1 && client_pool_join(p, names[i]) == 0) changes++;
+    }
+    return changes;
+}
+
+int client_pool_size(const client_pool *p) {
+    int n = 0;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) n += p->members[m] != NULL;
+    return n;
+}
+
+long client_pool_submit(client_pool *p, int a, int b, client_cb cb, void *arg) {
+    int32_t key[2] = { a, b };
+    uint32_t h = hash_bytes(2166136261u, key, sizeof(key));
+
+    while (p->n_points > 0) {
+        int m = route(p, h);
+        long id = client_submit(p->members[m], a, b, cb, arg);
+        if (id != CLIENT_ERR_IO) {
+            if (id > 0) p->routed[m]++;
+            return id;
+        }
+        drop_member(p, m);  // The ring now sends this key to the next instance
+    }
+    return CLIENT_ERR_IO;
+}
+
+long client_pool_submit_future(client_pool *p, int a, int b, client_future *f) {
+    f->done = 0;
+    f->status = CLIENT_OK;
+    f->larger = 0;
+    long id = client_pool_submit(p, a, b, future_done, f);
+    f->id = id > 0 ? (uint32_t)id : 0;
+    return id;
+}
+
+int client_pool_poll(client_pool *p, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    int done = 0;
+
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m] == NULL) continue;
+        if (flush_until(p->members[m], deadline) == CLIENT_ERR_IO) {
+            drop_member(p, m);
+            continue;
+        }
+        done += process_replies(p->members[m]) + expire_overdue(p->members[m]);
+    }
+
+    while (done == 0) {
+        struct pollfd pfd[CLIENT_POOL_MAX];
+        int owner[CLIENT_POOL_MAX];
+        int n_fds = 0;
+        for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+            if (p->members[m] == NULL || p->members[m]->inflight == 0) continue;
+            pfd[n_fds].fd = p->members[m]->reply_fd;
+            pfd[n_fds].events = POLLIN;
+            pfd[n_fds].revents = 0;
+            owner[n_fds++] = m;
+        }
+        if (n_fds == 0) break;
+
+        int timeout = remaining_ms(deadline);
+        for (int i = 0; i < n_fds; i++) timeout = expiry_timeout(p->members[owner[i]], timeout);
+        int n = poll(pfd, (nfds_t)n_fds, timeout);
+        if (n == -1 && errno != EINTR) return CLIENT_ERR_IO;
+        for (int i = 0; i < n_fds; i++) {
+            client *c = p->members[owner[i]];
+            if (n > 0 && (pfd[i].revents & POLLIN)) {
+                wire_reader_fill(&c->in);
+                done += process_replies(c);
+            }
+            done += expire_overdue(c);
+        }
+        if (done == 0 && deadline >= 0 && remaining_ms(deadline) == 0) break;
+    }
+    return done;
+}
+
+int client_pool_wait(client_pool *p, client_future *f, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    while (!f->done) {
+        int rc = client_pool_poll(p, remaining_ms(deadline));
+        if (rc < 0) return rc;
+        if (!f->done && deadline >= 0 && remaining_ms(deadline) == 0) {
+            for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+                if (p->members[m] != NULL) abandon(p->members[m], f->id, f);
+            }
+            return CLIENT_ERR_TIMEOUT;
+        }
+        if (!f->done && client_pool_inflight(p) == 0) return CLIENT_ERR_IO;  // Dropped with its instance
+    }
+    return f->status;
+}
+
+int client_pool_compare(client_pool *p, int a, int b, int *larger) {
+    client_future f;
+    long id = client_pool_submit_future(p, a, b, &f);
+    if (id < 0) return (int)id;
+    int rc = client_pool_wait(p, &f, CLIENT_TIMEOUT_MS);
+    if (rc == CLIENT_OK) *larger = f.larger;
+    return rc;
+}
+
+int client_pool_drain(client_pool *p, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : monotonic_ms() + timeout_ms;
+    while (client_pool_inflight(p) > 0) {
+        int rc = client_pool_poll(p, remaining_ms(deadline));
+        if (rc < 0) return rc;
+        if (rc == 0 && deadline >= 0 && remaining_ms(deadline) == 0) return CLIENT_ERR_TIMEOUT;
+    }
+    return CLIENT_OK;
+}
+
+long client_pool_inflight(const client_pool *p) {
+    long n = 0;
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m]) n += p->members[m]->inflight;
+    }
+    return n;
+}
+
+void client_pool_report(const client_pool *p, FILE *out) {
+    for (int m = 0; m < CLIENT_POOL_MAX; m++) {
+        if (p->members[m] == NULL) continue;
+        fprintf(out, "  instance %s: %ld requests\n",
+                p->names[m][0] ? p->names[m] : "(unnamed)", p->routed[m]);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "wire.h"
+
+// Client library for a daemon running in server mode. A connection is the
+// shared request FIFO plus this process's reply FIFO, both kept open for
+// its whole life, so any number of requests cost no process spawn and no
+// reopen. Requests are queued into a batch that goes out in one writev
+// when it fills, on client_flush(), or whenever the library waits for
+// replies. One connection per daemon instance and process: the reply FIFO
+// is named after both.
+
+#define CLIENT_MAX_INFLIGHT 4096   // Outstanding requests, power of two
+
+// Result codes passed to callbacks and returned by the blocking calls
+enum {
+    CLIENT_OK = 0,
+    CLIENT_ERR_IO = -1,        // FIFO error, server gone
+    CLIENT_ERR_TIMEOUT = -2,
+    CLIENT_ERR_REJECTED = -3,  // Server answered with an ERROR frame
+    CLIENT_ERR_PROTOCOL = -4,  // Corrupt or unexpected reply
+    CLIENT_ERR_EXPIRED = -5    // Its deadline passed first; the server dropped it
+};
+
+typedef struct client client;
+
+// Called from client_poll()/client_wait()/client_drain() once the answer
+// for a request arrives; `larger` is only meaningful when status is CLIENT_OK
+typedef void (*client_cb)(void *arg, int status, int larger);
+
+// Caller-owned handle of an asynchronous request
+typedef struct {
+    uint32_t id;
+    int done;
+    int status;
+    int larger;
+} client_future;
+
+// Connect to a named daemon instance; NULL or "" is the unnamed one
+client *client_connect_to(const char *instance);
+client *client_connect(void);
+
+// Outstanding requests complete with CLIENT_ERR_IO
+void client_close(client *c);
+
+// Blocking call: submit, flush and wait for this one answer
+int client_compare(client *c, int a, int b, int *larger);
+
+// Asynchronous submission. Returns the request ID, or a negative
+// CLIENT_ERR_* when the request could not be queued. When
+// CLIENT_MAX_INFLIGHT requests are outstanding, replies are processed
+// until a slot frees up.
+long client_submit(client *c, int a, int b, client_cb cb, void *arg);
+long client_submit_future(client *c, int a, int b, client_future *f);
+
+// Priority class (WIRE_PRIO_INTERACTIVE, the default, or WIRE_PRIO_BULK)
+// of the requests submitted from now on
+int client_set_priority(client *c, int priority);
+
+// Deadline of the requests submitted from now on, timeout_ms after their
+// submission (0, the default: none). Every stage of the server skips a
+// request once its deadline passed, and the request completes with
+// CLIENT_ERR_EXPIRED unless its answer arrived in time.
+int client_set_deadline(client *c, int timeout_ms);
+
+// Send everything queued so far
+int client_flush(client *c);
+
+// Process the replies that arrive within timeout_ms (-1 waits for at least
+// one). Returns the number of requests completed or a CLIENT_ERR_*.
+int client_poll(client *c, int timeout_ms);
+
+// Wait until f completes; returns its status
+int client_wait(client *c, client_future *f, int timeout_ms);
+
+// Wait until no request is outstanding
+int client_drain(client *c, int timeout_ms);
+
+long client_inflight(const client *c);
+
+const char *client_strerror(int status);
+
+// Routing over several daemon instances. Each instance owns CLIENT_VNODES
+// points on a hash ring and a request goes to the first point at or after
+// the hash of its operands, so equal requests always meet the same daemon
+// and an instance joining or leaving only moves the keys next to its own
+// points. An instance whose FIFO fails is dropped and its requests retried
+// on the next instance of the ring.
+
+#define CLIENT_POOL_MAX 16
+#define CLIENT_VNODES 64
+
+typedef struct client_pool client_pool;
+
+client_pool *client_pool_create(void);
+void client_pool_destroy(client_pool *p);
+
+int client_pool_join(client_pool *p, const char *instance);
+int client_pool_leave(client_pool *p, const char *instance);  // Drains first
+
+// Join instances that appeared in the working directory and drop the ones
+// that vanished. Returns how many joined or left.
+int client_pool_discover(client_pool *p);
+int client_pool_size(const client_pool *p);
+
+long client_pool_submit(client_pool *p, int a, int b, client_cb cb, void *arg);
+long client_pool_submit_future(client_pool *p, int a, int b, client_future *f);
+int client_pool_set_priority(client_pool *p, int priority);
+int client_pool_set_deadline(client_pool *p, int timeout_ms);
+int client_pool_compare(client_pool *p, int a, int b, int *larger);
+int client_pool_poll(client_pool *p, int timeout_ms);
+int client_pool_wait(client_pool *p, client_future *f, int timeout_ms);
+int client_pool_drain(client_pool *p, int timeout_ms);
+long client_pool_inflight(const client_pool *p);
+
+// One line per instance with the requests routed to it
+void client_pool_report(const client_pool *p, FILE *out);
+
+#endif
@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "server.h"
+#include "client.h"
+#include "parse_int.h"
+
+// Command line front end of the client library: one blocking request, or
+// a pipelined stream of them to measure running servers. Requests are
+// spread over every instance given with -i (or found with -D).
+
+typedef struct {
+    long completed;
+    long wrong;
+    long failed;
+    long expired;        // Given up on at their deadline, kept out of the latencies
+    int first_error;
+    double *latency_us;  // Per completed request, for percentiles
+} stream_stats;
+
+typedef struct {
+    stream_stats *stats;
+    int expected;
+    struct timespec sent;
+} stream_request;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-i name[,name...] | -D] [-n count] [-d depth] [-k keys] [-p class] [-T ms] <num1> <num2>\n", prog);
+    fprintf(stderr, "  -i names  daemon instances to route over (default: the unnamed one)\n");
+    fprintf(stderr, "  -D        route over every instance in the working directory\n");
+    fprintf(stderr, "  -n count  send count pipelined requests (num1+i, num2) and report throughput\n");
+    fprintf(stderr, "  -d depth  requests kept in flight with -n (default %d)\n", CLIENT_MAX_INFLIGHT / 4);
+    fprintf(stderr, "  -p class  priority: interactive (default) or bulk\n");
+    fprintf(stderr, "  -k keys   cycle num1 over keys values with -n, repeating requests (default: count)\n");
+    fprintf(stderr, "  -T ms     deadline of each request; the server drops it once passed\n");
+}
+
+static int parse_arg(const char *arg) {
+    int value;
+    int rc = parse_int_arg(arg, &value);
+    if (rc != PARSE_OK) {
+        fprintf(stderr, "Invalid number '%s': %s\n", arg, parse_strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void stream_done(void *arg, int status, int larger) {
+    stream_request *req = arg;
+    stream_stats *stats = req->stats;
+    if (status == CLIENT_ERR_EXPIRED) {
+        stats->expired++;
+        return;
+    }
+    stats->latency_us[stats->completed++] = elapsed_since(&req->sent) * 1e6;
+    if (status != CLIENT_OK) {
+        if (stats->failed++ == 0) stats->first_error = status;
+    } else if (larger != req->expected) {
+        stats->wrong++;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long n, double pct) {
+    long i = (long)(pct / 100.0 * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static int run_stream(client_pool *pool, int a, int b, long count, int depth, long keys) {
+    stream_request *reqs = malloc((size_t)count * sizeof(*reqs));
+    double *latency = malloc((size_t)count * sizeof(*latency));
+    if (reqs == NULL || latency == NULL) {
+        fprintf(stderr, "Cannot allocate %ld requests\n", count);
+        free(reqs);
+        free(latency);
+        return -1;
+    }
+    stream_stats stats = { 0, 0, 0, 0, CLIENT_OK, latency };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < count; i++) {
+        int x = (int)((long long)a + i % keys);
+        reqs[i].stats = &stats;
+        reqs[i].expected = x > b ? x : b;
+        while (client_pool_inflight(pool) >= depth && client_pool_poll(pool, CLIENT_TIMEOUT_MS) > 0) {}
+        clock_gettime(CLOCK_MONOTONIC, &reqs[i].sent);
+        long rc = client_pool_submit(pool, x, b, stream_done, &reqs[i]);
+        if (rc < 0) {
+            fprintf(stderr, "Request %ld: %s\n", i, client_strerror((int)rc));
+            break;
+        }
+    }
+    int rc = client_pool_drain(pool, CLIENT_TIMEOUT_MS);
+    double secs = elapsed_since(&start);
+
+    printf("Completed %ld of %ld requests in %.3f s (%.0f req/s), depth %d\n",
+           stats.completed, count, secs, secs > 0 ? stats.completed / secs : 0.0, depth);
+    if (stats.completed > 0) {
+        qsort(latency, (size_t)stats.completed, sizeof(*latency), compare_double);
+        printf("Latency us: p50 %.0f p99 %.0f max %.0f\n", percentile(latency, stats.completed, 50),
+               percentile(latency, stats.completed, 99), latency[stats.completed - 1]);
+    }
+    client_pool_report(pool, stdout);
+    if (stats.failed) {
+        printf("%ld failed, first: %s\n", stats.failed, client_strerror(stats.first_error));
+    }
+    if (stats.expired) printf("%ld expired\n", stats.expired);
+    if (stats.wrong) printf("%ld wrong answers\n", stats.wrong);
+    if (rc != CLIENT_OK) printf("Drain: %s\n", client_strerror(rc));
+
+    free(reqs);
+    free(latency);
+    return rc == CLIENT_OK && stats.completed + stats.expired == count && !stats.failed && !stats.wrong ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    long count = 0;
+    int depth = CLIENT_MAX_INFLIGHT / 4;
+    long keys = 0;
+    int priority = WIRE_PRIO_INTERACTIVE;
+    char *instances = NULL;
+    int discover = 0;
+    int deadline_ms = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:k:p:i:DT:")) != -1) {
+        switch (opt) {
+            case 'i':
+                instances = optarg;
+                break;
+            case 'D':
+                discover = 1;
+                break;
+            case 'n':
+                count = parse_arg(optarg);
+                break;
+            case 'd':
+                depth = parse_arg(optarg);
+                break;
+            case 'k':
+                keys = parse_arg(optarg);
+                break;
+            case 'T':
+                deadline_ms = parse_arg(optarg);
+                break;
+            case 'p':
+                if (strcmp(optarg, "interactive") == 0) {
+                    priority = WIRE_PRIO_INTERACTIVE;
+                } else if (strcmp(optarg, "bulk") == 0) {
+                    priority = WIRE_PRIO_BULK;
+                } else {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 2 || count < 0 || keys < 0 || depth < 1 || depth > CLIENT_MAX_INFLIGHT || deadline_ms < 0 ||
+        (instances && discover)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int a = parse_arg(argv[optind]);
+    int b = parse_arg(argv[optind + 1]);
+
+    signal(SIGPIPE, SIG_IGN);  // A vanished server shows up as an I/O error
+    client_pool *pool = client_pool_create();
+    if (pool == NULL) exit(EXIT_FAILURE);
+    client_pool_set_priority(pool, priority);
+    client_pool_set_deadline(pool, deadline_ms);
+    if (discover) {
+        client_pool_discover(pool);
+    } else if (instances) {
+        for (char *name = strtok(instances, ","); name; name = strtok(NULL, ",")) {
+            client_pool_join(pool, name);
+        }
+    } else {
+        client_pool_join(pool, NULL);
+    }
+    if (client_pool_size(pool) == 0) {
+        fprintf(stderr, "No server instance to talk to\n");
+        client_pool_destroy(pool);
+        exit(EXIT_FAILURE);
+    }
+
+    int rc;
+    if (count > 0) {
+        rc = run_stream(pool, a, b, count, depth, keys > 0 ? keys : count);
+    } else {
+        int larger = 0;
+        rc = client_pool_compare(pool, a, b, &larger);
+        if (rc == CLIENT_OK) {
+            printf("The larger number is: %d\n", larger);
+        } else {
+            fprintf(stderr, "%s\n", client_strerror(rc));
+        }
+    }
+
+    client_pool_destroy(pool);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
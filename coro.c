@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "coro.h"
+
+#define CORO_POLL_RETRY_MS 10  // Poll interval while the pollfd array cannot grow
+
+typedef struct coro {
+    ucontext_t ctx;
+    void *stack;          // Mapping base, lowest page is a guard page
+    size_t map_size;
+    coro_fn fn;
+    void *arg;
+    int fd;               // Descriptor waited on, -1 for a plain sleep
+    short events;
+    short revents;
+    long long deadline;   // Monotonic ms, -1 for no timeout
+    int done;
+    struct coro *next;    // Run queue or free list link
+} coro;
+
+static struct {
+    ucontext_t loop_ctx;
+    coro *current;
+    coro *run_head;
+    coro *run_tail;
+    coro **waiting;       // Parked coroutines, unordered
+    size_t n_waiting;
+    size_t cap_waiting;
+    struct pollfd *pfds;  // Scratch array, same length as waiting
+    size_t cap_pfds;
+    coro *free_list;      // Finished coroutines whose stacks get reused
+    size_t stack_size;
+    size_t page_size;
+    size_t live;
+    int stopping;
+} sched;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void run_enqueue(coro *c) {
+    c->next = NULL;
+    if (sched.run_tail) {
+        sched.run_tail->next = c;
+    } else {
+        sched.run_head = c;
+    }
+    sched.run_tail = c;
+}
+
+static coro *run_dequeue(void) {
+    coro *c = sched.run_head;
+    if (c) {
+        sched.run_head = c->next;
+        if (sched.run_head == NULL) sched.run_tail = NULL;
+    }
+    return c;
+}
+
+static void coro_entry(void) {
+    coro *c = sched.current;
+    c->fn(c->arg);
+    c->done = 1;
+    swapcontext(&c->ctx, &sched.loop_ctx);
+}
+
+int coro_sched_init(size_t stack_size) {
+    sched.stack_size = stack_size ? stack_size : CORO_STACK_SIZE;
+    sched.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    sched.stack_size = (sched.stack_size + sched.page_size - 1) & ~(sched.page_size - 1);
+    sched.current = NULL;
+    sched.run_head = sched.run_tail = NULL;
+    sched.n_waiting = 0;
+    sched.live = 0;
+    sched.stopping = 0;
+    return 0;
+}
+
+static coro *coro_alloc(void) {
+    coro *c = sched.free_list;
+    if (c) {
+        sched.free_list = c->next;
+        return c;
+    }
+
+    c = calloc(1, sizeof(coro));
+    if (c == NULL) return NULL;
+
+    c->map_size = sched.stack_size + sched.page_size;
+    c->stack = mmap(NULL, c->map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (c->stack == MAP_FAILED) {
+        free(c);
+        return NULL;
+    }
+    mprotect(c->stack, sched.page_size, PROT_NONE);  // Overflow faults instead of corrupting
+    return c;
+}
+
+// getcontext() may return twice as far as the compiler knows, so it gets
+// a frame of its own where nothing is live across it (-Wclobbered)
+static void __attribute__((noinline)) prepare_context(coro *const c) {
+    getcontext(&c->ctx);
+    c->ctx.uc_stack.ss_sp = (char *)c->stack + sched.page_size;
+    c->ctx.uc_stack.ss_size = sched.stack_size;
+    c->ctx.uc_link = &sched.loop_ctx;
+    makecontext(&c->ctx, coro_entry, 0);
+}
+
+int coro_spawn(coro_fn fn, void *arg) {
+    coro *c = coro_alloc();
+    if (c == NULL) return -1;
+
+    prepare_context(c);
+    c->fn = fn;
+    c->arg = arg;
+    c->fd = -1;
+    c->done = 0;
+    sched.live++;
+    run_enqueue(c);
+    return 0;
+}
+
+// Switch from the running coroutine back to the event loop
+static void coro_suspend(void) {
+    coro *c = sched.current;
+    swapcontext(&c->ctx, &sched.loop_ctx);
+}
+
+void coro_yield(void) {
+    if (sched.current == NULL) return;
+    run_enqueue(sched.current);
+    coro_suspend();
+}
+
+static int park(coro *c) {
+    if (sched.n_waiting == sched.cap_waiting) {
+        size_t cap = sched.cap_waiting ? sched.cap_waiting * 2 : 64;
+        coro **w = realloc(sched.waiting, cap * sizeof(*w));
+        if (w == NULL) return -1;
+        sched.waiting = w;
+        sched.cap_waiting = cap;
+    }
+    sched.waiting[sched.n_waiting++] = c;
+    return 0;
+}
+
+int coro_wait_fd(int fd, short events, int timeout_ms) {
+    coro *c = sched.current;
+    if (c == NULL || park(c) == -1) {
+        // Outside a coroutine (or out of memory): block the whole process
+        struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+        int n = poll(&pfd, fd >= 0 ? 1 : 0, timeout_ms);
+        return n > 0 ? pfd.revents : 0;
+    }
+
+    c->fd = fd;
+    c->events = events;
+    c->revents = 0;
+    c->deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    coro_suspend();
+    return c->revents;
+}
+
+void coro_sleep_ms(int ms) {
+    coro_wait_fd(-1, 0, ms);
+}
+
+// Poll every parked coroutine once and move the ready ones to the run queue
+static void poll_waiting(void) {
+    if (sched.cap_pfds < sched.n_waiting) {
+        struct pollfd *p = realloc(sched.pfds, sched.cap_waiting * sizeof(*p));
+        if (p != NULL) {
+            sched.pfds = p;
+            sched.cap_pfds = sched.cap_waiting;
+        }
+    }
+    // Out of memory: poll the descriptors that fit and only time the rest,
+    // waking up every CORO_POLL_RETRY_MS to retry rather than spinning
+    size_t polled = sched.n_waiting < sched.cap_pfds ? sched.n_waiting : sched.cap_pfds;
+
+    long long now = now_ms();
+    int timeout = polled < sched.n_waiting ? CORO_POLL_RETRY_MS : -1;
+    for (size_t i = 0; i < sched.n_waiting; i++) {
+        coro *c = sched.waiting[i];
+        if (i < polled) {
+            sched.pfds[i].fd = c->fd;
+            sched.pfds[i].events = c->events;
+            sched.pfds[i].revents = 0;
+        }
+        if (c->deadline >= 0) {
+            long long left = c->deadline > now ? c->deadline - now : 0;
+            if (timeout < 0 || left < timeout) timeout = (int)left;
+        }
+    }
+    // Runnable coroutines must not wait behind a blocking poll
+    if (sched.run_head) timeout = 0;
+
+    if (poll(sched.pfds, polled, timeout) == -1 && errno != EINTR) return;
+
+    now = now_ms();
+    size_t kept = 0;
+    for (size_t i = 0; i < sched.n_waiting; i++) {
+        coro *c = sched.waiting[i];
+        short revents = i < polled && sched.pfds[i].fd >= 0 ? sched.pfds[i].revents : 0;
+        if (revents || (c->deadline >= 0 && now >= c->deadline)) {
+            c->revents = revents;
+            run_enqueue(c);
+        } else {
+            sched.waiting[kept++] = c;
+        }
+    }
+    sched.n_waiting = kept;
+}
+
+void coro_run(void) {
+    while (!sched.stopping) {
+        coro *c;
+        while ((c = run_dequeue()) != NULL && !sched.stopping) {
+            sched.current = c;
+            swapcontext(&sched.loop_ctx, &c->ctx);
+            sched.current = NULL;
+            if (c->done) {
+                sched.live--;
+                c->next = sched.free_list;
+                sched.free_list = c;
+            }
+        }
+        if (sched.live == 0 || sched.stopping) break;
+        poll_waiting();
+    }
+}
+
+void coro_stop(void) {
+    sched.stopping = 1;
+}
+
+size_t coro_count(void) {
+    return sched.live;
+}
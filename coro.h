@@ -0,0 +1,37 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stddef.h>
+
+// Stackful coroutines with a poll()-driven event loop, one scheduler per
+// process. A coroutine that would block on a descriptor parks itself with
+// coro_wait_fd() and the loop resumes it once the descriptor is ready, so
+// one worker process can keep thousands of requests in flight.
+
+#define CORO_STACK_SIZE (64 * 1024)
+
+typedef void (*coro_fn)(void *arg);
+
+// Prepare the scheduler of this process. stack_size 0 means CORO_STACK_SIZE.
+int coro_sched_init(size_t stack_size);
+
+// Create a runnable coroutine. Returns 0, or -1 if no stack could be mapped.
+int coro_spawn(coro_fn fn, void *arg);
+
+// Give up the CPU to other runnable coroutines
+void coro_yield(void);
+
+// Park until fd reports one of `events` (POLLIN/POLLOUT) or timeout_ms
+// passes (-1 waits forever). Returns the revents seen, or 0 on timeout.
+int coro_wait_fd(int fd, short events, int timeout_ms);
+
+void coro_sleep_ms(int ms);
+
+// Run until no coroutines are left or coro_stop() is called
+void coro_run(void);
+void coro_stop(void);
+
+// Coroutines alive in this process (running, runnable or parked)
+size_t coro_count(void);
+
+#endif
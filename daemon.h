@@ -0,0 +1,58 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+#include "instance.h"
+
+// Endpoints of this daemon, named after its instance (-i)
+extern daemon_instance instance;
+#define FIFO1 (instance.fifo1)
+#define FIFO2 (instance.fifo2)
+#define LOG_FILE (instance.log)
+#define CHILD_TIMEOUT 15  // 15 seconds timeout
+#define MAX_CHILDREN 10
+
+// A profiling build (make pgo) writes its profile at exit(). Forked bulk
+// workers leave through _exit(), so they write theirs first; a SIGTERM only
+// asks a profiling server or stream worker to stop, and it leaves its loop
+// for exit(). Weak, so other builds leave it null; the training and
+// optimized builds must compile the same code for the profile to fit.
+void __gcov_dump(void) __attribute__((weak));
+#define PROFILING (__gcov_dump != NULL)
+#define PROFILE_DUMP() do { if (PROFILING) __gcov_dump(); } while (0)
+
+typedef struct {
+    pid_t pid;
+    time_t start_time;
+    int timed_out;   // Flag to mark terminated processes
+    int persistent;  // Long-lived server worker, exempt from CHILD_TIMEOUT
+} ChildProcess;
+
+extern ChildProcess child_table[MAX_CHILDREN];
+extern int num_children;
+extern volatile sig_atomic_t child_count;
+extern volatile sig_atomic_t total_children;
+extern volatile sig_atomic_t serving;         // Daemon runs in server mode
+extern volatile sig_atomic_t stop_requested;  // SIGTERM seen while serving or profiling
+extern volatile sig_atomic_t metrics_requested;  // SIGUSR1 seen while serving
+
+// Record a forked child in child_table, reusing the slot of a child that
+// already exited. Returns the slot index or -1 when the table is full.
+int track_child(pid_t pid, int persistent);
+
+// 1 once the SIGCHLD handler has reaped pid (or pid is not tracked)
+int child_exited(pid_t pid);
+
+// Start a worker process (spawn.h) running role with the given index; fd
+// is the descriptor of the shared state it maps, -1 for none. Returns its
+// PID or -1.
+pid_t start_worker(const char *role, int index, int fd, long long *started_ns);
+
+void check_timeouts(void);
+// Detach into the background. Every descriptor above stderr is closed
+// except keep_fd (-1 for none), which workers inherit later.
+int become_daemon(int keep_fd);
+
+#endif
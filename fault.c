@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+#include "fault.h"
+
+#define FAULT_DEFAULT_MS 100
+
+static const char *const kind_names[FAULT_KINDS] = {
+    "delay", "hang", "crash", "partial", "slow"
+};
+
+typedef struct {
+    double prob;
+    int ms;
+} fault_rule;
+
+static fault_rule rules[FAULT_KINDS];
+static int enabled = 0;
+static uint64_t seed = 0x9E3779B97F4A7C15ull;
+static uint64_t state;
+
+// xorshift64*: cheap, and good enough to spread faults
+static double next_uniform(void) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (double)((state * 0x2545F4914F6CDD1Dull) >> 11) / (double)(1ull << 53);
+}
+
+static int parse_rule(char *item) {
+    char *eq = strchr(item, '=');
+    if (eq == NULL) return -1;
+    *eq = '\0';
+
+    int kind = 0;
+    while (kind < FAULT_KINDS && strcmp(item, kind_names[kind]) != 0) kind++;
+    if (kind == FAULT_KINDS) return -1;
+
+    char *end;
+    double prob = strtod(eq + 1, &end);
+    if (end == eq + 1 || prob < 0.0 || prob > 1.0) return -1;
+    long ms = FAULT_DEFAULT_MS;
+    if (*end == ':') {
+        char *ms_text = end + 1;
+        ms = strtol(ms_text, &end, 10);
+        if (end == ms_text || ms < 0 || ms > 3600 * 1000) return -1;
+    }
+    if (*end != '\0') return -1;
+
+    rules[kind].prob = prob;
+    rules[kind].ms = (int)ms;
+    return 0;
+}
+
+int fault_init(const char *spec) {
+    memset(rules, 0, sizeof(rules));
+    enabled = 0;
+    if (spec == NULL || spec[0] == '\0') return 0;
+
+    char copy[256];
+    if (strlen(spec) >= sizeof(copy)) return -1;
+    strcpy(copy, spec);
+    for (char *item = strtok(copy, ","); item; item = strtok(NULL, ",")) {
+        if (parse_rule(item) == -1) {
+            memset(rules, 0, sizeof(rules));
+            return -1;
+        }
+    }
+
+    const char *seed_text = getenv(FAULT_SEED_ENV);
+    if (seed_text) seed = strtoull(seed_text, NULL, 10);
+    enabled = 1;
+    fault_process();
+    return 0;
+}
+
+void fault_process(void) {
+    state = seed ^ ((uint64_t)getpid() * 0x9E3779B97F4A7C15ull);
+    if (state == 0) state = 1;
+}
+
+int fault_enabled(void) {
+    return enabled;
+}
+
+int fault_configured(fault_kind kind) {
+    return enabled && rules[kind].prob > 0.0;
+}
+
+int fault_hit(fault_kind kind) {
+    return enabled && rules[kind].prob > 0.0 && next_uniform() < rules[kind].prob;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1) {}
+}
+
+void fault_stage(const char *where) {
+    if (!enabled) return;
+    if (fault_hit(FAULT_CRASH)) {
+        printf("Fault: crashing %s (PID %d)\n", where, (int)getpid());
+        fflush(stdout);
+        raise(SIGKILL);
+    }
+    if (fault_hit(FAULT_HANG)) {
+        printf("Fault: hanging %s (PID %d)\n", where, (int)getpid());
+        fflush(stdout);
+        for (;;) pause();
+    }
+    if (fault_hit(FAULT_DELAY)) sleep_ms(rules[FAULT_DELAY].ms);
+}
+
+size_t fault_partial(size_t len) {
+    if (len < 2 || !fault_hit(FAULT_PARTIAL)) return 0;
+    return 1 + (size_t)(next_uniform() * (double)(len - 1));  // 1..len-1 bytes
+}
+
+void fault_slow(void) {
+    if (fault_hit(FAULT_SLOW)) sleep_ms(rules[FAULT_SLOW].ms);
+}
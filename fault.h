@@ -0,0 +1,52 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stddef.h>
+
+// Fault injection for chaos and soak runs, configured from the environment
+// so that a plain daemon is unaffected:
+//
+//   DAEMON_FAULTS="delay=0.001:50,hang=0.00001,crash=0.00001,partial=0.0005,slow=0.01:20"
+//   DAEMON_FAULT_SEED=42
+//
+// Each rule is kind=probability[:milliseconds], rolled once per request at
+// the stage that owns the fault. Every process draws from its own stream,
+// seeded from the seed and its PID.
+
+#define FAULT_ENV "DAEMON_FAULTS"
+#define FAULT_SEED_ENV "DAEMON_FAULT_SEED"
+
+typedef enum {
+    FAULT_DELAY,    // Stall the stage for ms (default 100)
+    FAULT_HANG,     // Stop making progress until killed
+    FAULT_CRASH,    // Die on the spot with SIGKILL, no cleanup
+    FAULT_PARTIAL,  // Write a torn frame before the real ones
+    FAULT_SLOW,     // Reader pauses ms (default 100) before draining its input
+    FAULT_KINDS
+} fault_kind;
+
+// Parse a spec; NULL or "" disables every fault. Returns 0, or -1 when the
+// spec is malformed (nothing is enabled then).
+int fault_init(const char *spec);
+
+// Reseed after fork so siblings do not inject in lockstep
+void fault_process(void);
+
+int fault_enabled(void);
+
+// 1 when the spec gave kind a non-zero probability
+int fault_configured(fault_kind kind);
+
+// Roll the dice for one kind. Returns 1 when the fault fires.
+int fault_hit(fault_kind kind);
+
+// Delay, hang or crash here, as the rules say
+void fault_stage(const char *where);
+
+// Bytes of a len-byte frame to write as a torn fragment, 0 for none
+size_t fault_partial(size_t len);
+
+// Stall a reader before it drains its input
+void fault_slow(void);
+
+#endif
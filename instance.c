@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "instance.h"
+
+static int valid_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= INSTANCE_NAME_MAX) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_') return 0;
+    }
+    return 1;
+}
+
+int instance_init(daemon_instance *inst, const char *name) {
+    memset(inst, 0, sizeof(*inst));
+    if (name == NULL || name[0] == '\0') {
+        snprintf(inst->fifo1, sizeof(inst->fifo1), "fifo1");
+        snprintf(inst->fifo2, sizeof(inst->fifo2), "fifo2");
+        snprintf(inst->log, sizeof(inst->log), "daemon_log.txt");
+        snprintf(inst->ring, sizeof(inst->ring), "/daemon_results");
+        return 0;
+    }
+    if (!valid_name(name)) return -1;
+
+    snprintf(inst->name, sizeof(inst->name), "%s", name);
+    snprintf(inst->fifo1, sizeof(inst->fifo1), "fifo1.%s", name);
+    snprintf(inst->fifo2, sizeof(inst->fifo2), "fifo2.%s", name);
+    snprintf(inst->log, sizeof(inst->log), "daemon_log.%s.txt", name);
+    snprintf(inst->ring, sizeof(inst->ring), "/daemon_results.%s", name);
+    return 0;
+}
+
+void instance_reply_path(const daemon_instance *inst, pid_t client, char *buf, size_t len) {
+    if (inst->name[0] == '\0') {
+        snprintf(buf, len, "reply.%d", (int)client);
+    } else {
+        snprintf(buf, len, "reply.%s.%d", inst->name, (int)client);
+    }
+}
+
+int instance_set_cpus(daemon_instance *inst, const char *list) {
+    inst->n_cpus = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) return -1;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpu >= CPU_SETSIZE || inst->n_cpus == INSTANCE_MAX_CPUS) return -1;
+            inst->cpus[inst->n_cpus++] = (int)cpu;
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return inst->n_cpus > 0 ? 0 : -1;
+}
+
+int instance_pin(const daemon_instance *inst, int index) {
+    if (inst->n_cpus == 0) return -1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(inst->cpus[index % inst->n_cpus], &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int instance_discover(char names[][INSTANCE_NAME_MAX], int max) {
+    DIR *dir = opendir(".");
+    if (dir == NULL) return 0;
+
+    int found = 0;
+    struct dirent *ent;
+    while (found < max && (ent = readdir(dir)) != NULL) {
+        const char *name;
+        if (strcmp(ent->d_name, "fifo1") == 0) {
+            name = "";
+        } else if (strncmp(ent->d_name, "fifo1.", 6) == 0 && valid_name(ent->d_name + 6)) {
+            name = ent->d_name + 6;
+        } else {
+            continue;
+        }
+        struct stat st;
+        if (stat(ent->d_name, &st) == -1 || !S_ISFIFO(st.st_mode)) continue;
+        snprintf(names[found++], INSTANCE_NAME_MAX, "%s", name);
+    }
+    closedir(dir);
+    return found;
+}
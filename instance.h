@@ -0,0 +1,44 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Several daemons can share a working directory when each gets an instance
+// name: its endpoints become fifo1.<name>, fifo2.<name>, daemon_log.<name>.txt
+// and reply.<name>.<pid>. The unnamed instance keeps fifo1, fifo2,
+// daemon_log.txt and reply.<pid>. The result ring (ring.h) is shared memory
+// and so is named machine-wide: /dev/shm/daemon_results[.<name>].
+
+#define INSTANCE_NAME_MAX 32
+#define INSTANCE_PATH_MAX 64
+#define INSTANCE_MAX_CPUS 256
+
+typedef struct {
+    char name[INSTANCE_NAME_MAX];   // "" for the unnamed instance
+    char fifo1[INSTANCE_PATH_MAX];  // Requests
+    char fifo2[INSTANCE_PATH_MAX];  // Results, internal to the daemon
+    char log[INSTANCE_PATH_MAX];
+    char ring[INSTANCE_PATH_MAX];   // shm_open() name of the result ring
+    int cpus[INSTANCE_MAX_CPUS];    // Workers are pinned round-robin here
+    int n_cpus;                     // 0: no explicit placement
+} daemon_instance;
+
+// Fill in the endpoint paths. Names may use letters, digits, '-' and '_'.
+// Returns 0, or -1 for an invalid name.
+int instance_init(daemon_instance *inst, const char *name);
+
+void instance_reply_path(const daemon_instance *inst, pid_t client, char *buf, size_t len);
+
+// Parse a CPU list such as "0-3,8,10-11" into inst->cpus. Returns 0 or -1.
+int instance_set_cpus(daemon_instance *inst, const char *list);
+
+// Pin the calling process to the index-th CPU of the instance. Returns -1
+// when the instance has no CPU list or the kernel refused.
+int instance_pin(const daemon_instance *inst, int index);
+
+// Names of the instances with a request FIFO in the working directory;
+// the unnamed instance is reported as "". Returns how many were found.
+int instance_discover(char names[][INSTANCE_NAME_MAX], int max);
+
+#endif
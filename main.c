@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE  // wait4()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,32 +8,54 @@
 #include <sys/stat.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "daemon.h"
+#include "server.h"
+#include "stream.h"
+#include "client.h"
+#include "reduce.h"
+#include "bulk.h"
+#include "parse_int.h"
+#include "spsc_queue.h"
+#include "trace.h"
+#include "fault.h"
+#include "spawn.h"
+#include "pool_limits.h"
 
-#define FIFO1 "fifo1"
-#define FIFO2 "fifo2"
-#define LOG_FILE "daemon_log.txt"
-#define CHILD_TIMEOUT 15  // 15 seconds timeout
-#define MAX_CHILDREN 10
+#define STAGE_QUEUE_CAPACITY 1024  // Records per in-memory stage queue
 
-typedef struct {
-    pid_t pid;
-    time_t start_time;
-    int timed_out;  // Flag to mark terminated processes
-} ChildProcess;
+// How the compare and output stages run: as forked processes talking over
+// the FIFOs (isolated, killable on timeout) or as threads inside the daemon
+// joined by lock-free queues (no context switch or pipe copy per hop)
+typedef enum { EXEC_PROCESS, EXEC_THREAD } exec_mode;
 
+#ifndef EXEC_MODE_DEFAULT
+#define EXEC_MODE_DEFAULT EXEC_PROCESS
+#endif
+
+daemon_instance instance;
 ChildProcess child_table[MAX_CHILDREN];
 int num_children = 0;
 volatile sig_atomic_t child_count = 0;
 volatile sig_atomic_t total_children = 0;
+volatile sig_atomic_t serving = 0;
+volatile sig_atomic_t stop_requested = 0;
+volatile sig_atomic_t metrics_requested = 0;
+static const char *worker_cpus = "";  // -a as given, passed on to the workers
+static int in_worker = 0;
 
 // Signal handler for SIGCHLD
 void sigchld_handler(int sig) {
     (void)sig;
     int status;
     pid_t pid;
+    struct rusage ru;
     char buf[100];
     time_t now;
     
@@ -40,7 +63,8 @@ void sigchld_handler(int sig) {
     char *time_str = ctime(&now);
     time_str[strlen(time_str)-1] = '\0'; // Remove newline
     
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        limits_reaped(pid, &ru);
         if (WIFEXITED(status)) {
             snprintf(buf, sizeof(buf), "[%s] Child %d exited with status %d\n",
                     time_str, pid, WEXITSTATUS(status));
@@ -75,6 +99,7 @@ void daemon_signal_handler(int sig) {
     switch(sig) {
         case SIGUSR1:
             snprintf(buf, sizeof(buf), "[%s] SIGUSR1 received\n", time_str);
+            if (serving) metrics_requested = 1;  // Server prints its counters
             break;
         case SIGHUP:
             snprintf(buf, sizeof(buf), "[%s] SIGHUP received\n", time_str);
@@ -89,17 +114,51 @@ void daemon_signal_handler(int sig) {
     write(STDERR_FILENO, buf, strlen(buf));
     
     if (sig == SIGTERM) {
+        // The server loop shuts its workers down and removes the FIFOs; a
+        // profiling worker returns to its loop to exit() with its profile
+        if (serving || (in_worker && PROFILING)) {
+            stop_requested = 1;
+            return;
+        }
         _exit(EXIT_SUCCESS);
     }
 }
 
+int track_child(pid_t pid, int persistent) {
+    int slot = -1;
+    for (int i = 0; i < num_children; i++) {
+        if (child_table[i].timed_out) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        if (num_children >= MAX_CHILDREN) return -1;
+        slot = num_children;
+    }
+
+    child_table[slot].pid = pid;
+    child_table[slot].start_time = time(NULL);
+    child_table[slot].persistent = persistent;
+    child_table[slot].timed_out = 0;
+    if (slot == num_children) num_children++;
+    return slot;
+}
+
+int child_exited(pid_t pid) {
+    for (int i = 0; i < num_children; i++) {
+        if (child_table[i].pid == pid) return child_table[i].timed_out;
+    }
+    return 1;
+}
+
 
 // Timeout monitoring function
-void check_timeouts() {
+void check_timeouts(void) {
     time_t now = time(NULL);
     
     for (int i = 0; i < num_children; i++) {
-        if (!child_table[i].timed_out && 
+        if (!child_table[i].timed_out && !child_table[i].persistent &&
             (now - child_table[i].start_time > CHILD_TIMEOUT)) {
             
             pid_t pid = child_table[i].pid;
@@ -111,10 +170,13 @@ void check_timeouts() {
             sleep(1);
             
             // Force kill if still running
-            if (waitpid(pid, NULL, WNOHANG) == 0) {
+            struct rusage ru;
+            pid_t reaped = wait4(pid, NULL, WNOHANG, &ru);
+            if (reaped == 0) {
                 kill(pid, SIGKILL);
-                waitpid(pid, NULL, 0);  // Reap the zombie
+                reaped = wait4(pid, NULL, 0, &ru);  // Reap the zombie
             }
+            if (reaped == pid) limits_reaped(pid, &ru);
             
             child_table[i].timed_out = 1;
             child_count++;
@@ -123,7 +185,7 @@ void check_timeouts() {
 }
 
 // Become a daemon
-int become_daemon() {
+int become_daemon(int keep_fd) {
     // First fork
     switch (fork()) {
         case -1: return -1;
@@ -158,7 +220,9 @@ int become_daemon() {
 
     // Close all other descriptors
     int maxfd = sysconf(_SC_OPEN_MAX);
-    for (int fd = 3; fd < maxfd; fd++) close(fd);
+    for (int fd = 3; fd < maxfd; fd++) {
+        if (fd != keep_fd) close(fd);
+    }
 
     // Redirect stdin from /dev/null
     int null_fd = open("/dev/null", O_RDONLY);
@@ -171,56 +235,541 @@ int become_daemon() {
 }
 
 void child_process1() {
-    sleep(10);
+    fault_process();
+    fault_stage("child_process1");  // A hang here is what CHILD_TIMEOUT is for
+    trace_process("child_process1");
     printf("Child 1 started\n");
     fflush(stdout);
-    
+
+    trace_mark mark;
+    trace_begin(&mark, 1);
     int fd1 = open(FIFO1, O_RDONLY);
     if (fd1 == -1) exit(EXIT_FAILURE);
 
     int nums[2];
     if (read(fd1, nums, sizeof(nums)) == -1) exit(EXIT_FAILURE);
     close(fd1);
+    trace_end("dequeue", &mark, 0, 0);
 
+    trace_begin(&mark, 1);
     int larger = (nums[0] > nums[1]) ? nums[0] : nums[1];
     printf("Child 1: Larger of %d and %d is %d\n", nums[0], nums[1], larger);
     fflush(stdout);
+    trace_end("compute", &mark, 0, 0);
+
+    trace_begin(&mark, 1);
     int fd2 = open(FIFO2, O_WRONLY);
     if (fd2 == -1) exit(EXIT_FAILURE);
     
     if (write(fd2, &larger, sizeof(larger)) == -1) exit(EXIT_FAILURE);
     close(fd2);
+    trace_end("emit", &mark, 0, 0);
 
+    trace_flush();
     exit(EXIT_SUCCESS);
 }
 
 void child_process2() {
-    sleep(10); // This will trigger timeout
+    fault_process();
+    fault_stage("child_process2");
+    trace_process("child_process2");
     printf("Child 2 started\n");
     fflush(stdout);
+
+    trace_mark mark;
+    trace_begin(&mark, 1);
     int fd = open(FIFO2, O_RDONLY);
     if (fd == -1) exit(EXIT_FAILURE);
     
     int larger;
     if (read(fd, &larger, sizeof(larger)) == -1) exit(EXIT_FAILURE);
     close(fd);
+    trace_end("dequeue", &mark, 0, 0);
 
+    trace_begin(&mark, 1);
     printf("The larger number is: %d\n", larger);
     fflush(stdout);
+    trace_end("emit", &mark, 0, 0);
+
+    trace_flush();
+    exit(EXIT_SUCCESS);
+}
+
+// Sharded replacement for child_process1 when the input has more than two
+// values: reduce chunks of the shared job, and if this worker completed the
+// tree, hand the maximum to child_process2 over FIFO2 like child_process1
+void reduce_process(reduce_job *job, int index) {
+    if (instance_pin(&instance, index) == -1) reduce_pin_worker(index);
+    fault_process();
+    fault_stage("reduce worker");
+    trace_process("reduce worker");
+    printf("Reduce worker %d started\n", index);
+    fflush(stdout);
+
+    trace_mark mark;
+    trace_begin(&mark, 1);
+    int last = reduce_worker(job);
+    trace_end("compute", &mark, 0, 0);
+    if (!last) {
+        trace_flush();
+        exit(EXIT_SUCCESS);
+    }
+
+    trace_begin(&mark, 1);
+    reduce_result res = reduce_job_result(job);
+    int fd2 = open(FIFO2, O_WRONLY);
+    if (fd2 == -1) exit(EXIT_FAILURE);
+
+    if (write(fd2, &res.max, sizeof(res.max)) == -1) exit(EXIT_FAILURE);
+    close(fd2);
+    trace_end("emit", &mark, 0, 0);
+    trace_flush();
     exit(EXIT_SUCCESS);
 }
 
+void log_reduce_result(const reduce_job *job) {
+    reduce_result res = reduce_job_result(job);
+    printf("Reduced %zu values: max %d at index %zu, min %d, sum %lld\n",
+           res.count, res.max, res.argmax, res.min, res.sum);
+    fflush(stdout);
+}
+
+// Queues joining the stages in thread mode
+typedef struct {
+    spsc_queue to_compare;  // int[2] pairs from the daemon
+    spsc_queue to_output;   // int results from the compare stage
+    reduce_job *job;        // Set when reduce threads replace the compare stage
+} stage_queues;
+
+void *compare_thread(void *arg) {
+    stage_queues *qs = arg;
+    printf("Compare thread started\n");
+    fflush(stdout);
+
+    int nums[2];
+    while (spsc_queue_pop(&qs->to_compare, nums) == 0) {
+        int larger = (nums[0] > nums[1]) ? nums[0] : nums[1];
+        printf("Compare thread: Larger of %d and %d is %d\n", nums[0], nums[1], larger);
+        spsc_queue_push(&qs->to_output, &larger);
+    }
+    spsc_queue_close(&qs->to_output);
+    return NULL;
+}
+
+void *output_thread(void *arg) {
+    stage_queues *qs = arg;
+    printf("Output thread started\n");
+    fflush(stdout);
+
+    int larger;
+    while (spsc_queue_pop(&qs->to_output, &larger) == 0) {
+        printf("The larger number is: %d\n", larger);
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+void *reduce_thread(void *arg) {
+    stage_queues *qs = arg;
+    if (reduce_worker(qs->job)) {
+        int larger = reduce_job_result(qs->job).max;
+        spsc_queue_push(&qs->to_output, &larger);
+    }
+    return NULL;
+}
+
+// Run the reduction on `workers` threads feeding the output thread
+int run_thread_reduce(reduce_job *job, int workers) {
+    stage_queues qs;
+    pthread_t reduce_tids[REDUCE_MAX_WORKERS], output_tid;
+    int started = 0;
+
+    qs.job = job;
+    if (spsc_queue_init(&qs.to_output, STAGE_QUEUE_CAPACITY, sizeof(int)) == -1) {
+        return -1;
+    }
+    if (pthread_create(&output_tid, NULL, output_thread, &qs) != 0) {
+        fprintf(stderr, "pthread_create failed for output stage\n");
+        spsc_queue_destroy(&qs.to_output);
+        return -1;
+    }
+    while (started < workers &&
+           pthread_create(&reduce_tids[started], NULL, reduce_thread, &qs) == 0) {
+        started++;
+    }
+    // Fewer threads only means less parallelism, unless none started
+    if (started == 0) reduce_thread(&qs);
+
+    for (int i = 0; i < started; i++) pthread_join(reduce_tids[i], NULL);
+    spsc_queue_close(&qs.to_output);
+    pthread_join(output_tid, NULL);
+    spsc_queue_destroy(&qs.to_output);
+    return 0;
+}
+
+// Run both stages as threads of the daemon and push one pair through them
+int run_thread_pipeline(const int nums[2]) {
+    stage_queues qs;
+    pthread_t compare_tid, output_tid;
+
+    if (spsc_queue_init(&qs.to_compare, STAGE_QUEUE_CAPACITY, sizeof(int[2])) == -1) {
+        return -1;
+    }
+    if (spsc_queue_init(&qs.to_output, STAGE_QUEUE_CAPACITY, sizeof(int)) == -1) {
+        spsc_queue_destroy(&qs.to_compare);
+        return -1;
+    }
+
+    if (pthread_create(&compare_tid, NULL, compare_thread, &qs) != 0) {
+        fprintf(stderr, "pthread_create failed for compare stage\n");
+        spsc_queue_destroy(&qs.to_compare);
+        spsc_queue_destroy(&qs.to_output);
+        return -1;
+    }
+    if (pthread_create(&output_tid, NULL, output_thread, &qs) != 0) {
+        fprintf(stderr, "pthread_create failed for output stage\n");
+        spsc_queue_close(&qs.to_compare);
+        pthread_join(compare_tid, NULL);
+        spsc_queue_destroy(&qs.to_compare);
+        spsc_queue_destroy(&qs.to_output);
+        return -1;
+    }
+    printf("Daemon started. Stage threads running\n");
+    fflush(stdout);
+
+    spsc_queue_push(&qs.to_compare, nums);
+    spsc_queue_close(&qs.to_compare);
+
+    pthread_join(compare_tid, NULL);
+    pthread_join(output_tid, NULL);
+    spsc_queue_destroy(&qs.to_compare);
+    spsc_queue_destroy(&qs.to_output);
+    return 0;
+}
+
+// Read whitespace separated integers from path into a fresh reduce job
+reduce_job *load_values(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char *text = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "mmap %s failed: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (size) posix_madvise((void *)text, size, POSIX_MADV_SEQUENTIAL);
+
+    // Every value takes at least two bytes with its separator
+    int *values = malloc((size / 2 + 1) * sizeof(int));
+    size_t n = 0;
+    const char *p = text, *end = text + size;
+    int rc = PARSE_OK;
+    while (values != NULL) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+        if ((rc = parse_int32(&p, end, 0, &values[n])) != PARSE_OK) break;
+        n++;
+    }
+
+    reduce_job *job = NULL;
+    if (values == NULL) {
+        fprintf(stderr, "Out of memory reading %s\n", path);
+    } else if (rc != PARSE_OK) {
+        fprintf(stderr, "%s: offset %ld: %s\n", path, (long)(p - text), parse_strerror(rc));
+    } else if ((job = reduce_job_create(n)) != NULL) {
+        memcpy(reduce_job_data(job), values, n * sizeof(int));
+    }
+    free(values);
+    if (size) munmap((void *)text, size);
+    return job;
+}
+
+// Workers are told everything the daemon learned from its own command line
+// and the descriptors of the shared state they attach to
+pid_t start_worker(const char *role, int index, int fd, long long *started_ns) {
+    char index_arg[16], trace_arg[16], counters_arg[4], fd_arg[16];
+    int counters;
+    snprintf(index_arg, sizeof(index_arg), "%d", index);
+    snprintf(trace_arg, sizeof(trace_arg), "%d", trace_descriptor(&counters));
+    snprintf(counters_arg, sizeof(counters_arg), "%d", counters);
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fd);
+    char *args[] = {
+        (char *)role, index_arg, instance.name, (char *)worker_cpus,
+        trace_arg, counters_arg, fd_arg, NULL
+    };
+    // Limited before the SIGCHLD handler can see it go
+    sigset_t chld_mask, old_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+    pid_t pid = spawn_process(args, started_ns);
+    if (pid != -1) limits_apply(role, pid);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return pid;
+}
+
+// Entry of every worker: role index instance cpus trace-fd counters fd
+int worker_main(int argc, char *argv[]) {
+    int index, trace_fd, counters, fd;
+    char name[INSTANCE_NAME_MAX];  // A forked worker's argv points into instance
+    if (argc != 7 || parse_int_arg(argv[1], &index) != PARSE_OK ||
+        parse_int_arg(argv[4], &trace_fd) != PARSE_OK ||
+        parse_int_arg(argv[5], &counters) != PARSE_OK ||
+        parse_int_arg(argv[6], &fd) != PARSE_OK ||
+        snprintf(name, sizeof(name), "%s", argv[2]) >= (int)sizeof(name) ||
+        instance_init(&instance, name) == -1 ||
+        (argv[3][0] != '\0' && instance_set_cpus(&instance, argv[3]) == -1)) {
+        fprintf(stderr, "Invalid worker arguments\n");
+        return EXIT_FAILURE;
+    }
+    const char *role = argv[0];
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    setvbuf(stderr, NULL, _IOLBF, 0);
+    serving = 0;  // SIGTERM exits a worker right away, unless profiling
+    in_worker = 1;
+
+    struct sigaction dsa;
+    dsa.sa_handler = daemon_signal_handler;
+    sigemptyset(&dsa.sa_mask);
+    dsa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &dsa, NULL);
+    sigaction(SIGHUP, &dsa, NULL);
+    dsa.sa_flags = 0;  // A blocked read gives way to stop_requested
+    sigaction(SIGTERM, &dsa, NULL);
+    if (trace_fd != -1) trace_attach(trace_fd, counters);
+
+    if (strcmp(role, "child1") == 0) {
+        child_process1();
+    } else if (strcmp(role, "child2") == 0) {
+        child_process2();
+    } else if (strcmp(role, "reduce") == 0) {
+        reduce_job *job = reduce_job_attach(fd);
+        if (job == NULL) {
+            printf("Cannot map the reduce job in worker %d\n", index);
+            return EXIT_FAILURE;
+        }
+        reduce_process(job, index);
+    } else if (strcmp(role, "window") == 0 || strcmp(role, "report") == 0) {
+        return run_stream_worker(role, index, fd);
+    }
+    return run_server_worker(role, index, fd);
+}
+
+// Strict replacement for atoi(): malformed arguments end the program
+int parse_arg(const char *arg) {
+    int value;
+    int rc = parse_int_arg(arg, &value);
+    if (rc != PARSE_OK) {
+        fprintf(stderr, "Invalid number '%s': %s\n", arg, parse_strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m process|thread] [-w workers] <num1> <num2> [num...]\n", prog);
+    fprintf(stderr, "       %s [-m process|thread] [-w workers] -f <file>\n", prog);
+    fprintf(stderr, "       %s -s [-w workers]   (serve requests on fifo1[.<name>])\n", prog);
+    fprintf(stderr, "       %s -b <input> -o <output> [-w workers]  (offline bulk mode)\n", prog);
+    fprintf(stderr, "       %s -c <num1> <num2>  (ask a running server)\n", prog);
+    fprintf(stderr, "       %s -W <n|nms|ns> [-e ms]  (sliding-window max/min of a stream on fifo1[.<name>])\n", prog);
+    fprintf(stderr, "  -i <name>   instance name: use fifo1.<name>, fifo2.<name>, daemon_log.<name>.txt\n");
+    fprintf(stderr, "  -a <cpus>   pin this instance's workers to a CPU list such as 0-3,8\n");
+    fprintf(stderr, "  -t <file>   trace every stage into file (Chrome/Perfetto JSON)\n");
+    fprintf(stderr, "  -T          add hardware counters to the trace (with -t)\n");
+    fprintf(stderr, "  -p exec|fork  how workers are started (default exec)\n");
+    fprintf(stderr, "  -C <file>   capture every request served into file, for replay (with -s)\n");
+    fprintf(stderr, "  -L [pool:]cpu=<weight>,mem=<bytes>[k|m|g],io=<weight>\n");
+    fprintf(stderr, "              limit every worker pool, or the one named (compare, output,\n");
+    fprintf(stderr, "              child1, reduce...), by cgroup v2 where available\n");
+    fprintf(stderr, "  -W <window> last n values, or the values of the last n ms or s\n");
+    fprintf(stderr, "  -e <ms>     how often the window's max and min are reported (default %d)\n",
+            STREAM_DEFAULT_EMIT_MS);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <num1> <num2>\n", argv[0]);
+    exec_mode mode = EXEC_MODE_DEFAULT;
+    server_config server = { .workers = SERVE_DEFAULT_WORKERS };
+    const char *input_file = NULL;
+    bulk_config bulk = { NULL, NULL, 0 };
+    reduce_job *job = NULL;
+    stream_config stream = { WINDOW_COUNT, 0, STREAM_DEFAULT_EMIT_MS };
+    int serve = 0, use_client = 0, streaming = 0;
+    const char *cpu_list = NULL;
+    const char *trace_path = NULL;
+    int trace_counters = 0;
+    spawn_method spawn = SPAWN_EXEC;
+    int opt;
+
+    instance_init(&instance, NULL);
+    if (fault_init(getenv(FAULT_ENV)) == -1) {
+        fprintf(stderr, "Invalid %s '%s'\n", FAULT_ENV, getenv(FAULT_ENV));
         exit(EXIT_FAILURE);
-    }    
+    }
+    if (spawn_is_worker(argc, argv)) return worker_main(argc - 2, argv + 2);
+
+    while ((opt = getopt(argc, argv, "m:sw:cf:b:o:i:a:t:Tp:W:e:L:C:")) != -1) {
+        switch (opt) {
+            case 's':
+                serve = 1;
+                break;
+            case 'w':
+                server.workers = parse_arg(optarg);
+                if (server.workers < 1 || server.workers > SERVE_MAX_WORKERS) {
+                    fprintf(stderr, "workers must be between 1 and %d\n", SERVE_MAX_WORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                use_client = 1;
+                break;
+            case 'f':
+                input_file = optarg;
+                break;
+            case 'b':
+                bulk.input = optarg;
+                break;
+            case 'o':
+                bulk.output = optarg;
+                break;
+            case 'i':
+                if (instance_init(&instance, optarg) == -1) {
+                    fprintf(stderr, "Invalid instance name '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                cpu_list = optarg;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'T':
+                trace_counters = 1;
+                break;
+            case 'p':
+                if (spawn_parse_method(optarg, &spawn) == -1) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                server.capture = optarg;
+                break;
+            case 'L':
+                if (limits_parse(optarg) == -1) {
+                    fprintf(stderr, "Invalid limits '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                if (stream_parse_window(optarg, &stream) == -1) {
+                    fprintf(stderr, "Invalid window '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                streaming = 1;
+                break;
+            case 'e':
+                stream.emit_ms = parse_arg(optarg);
+                if (stream.emit_ms < 1) {
+                    fprintf(stderr, "emit interval must be at least 1 ms\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "process") == 0) {
+                    mode = EXEC_PROCESS;
+                } else if (strcmp(optarg, "thread") == 0) {
+                    mode = EXEC_THREAD;
+                } else {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // After the loop: -i resets the instance, so the CPU list goes on last
+    if (cpu_list && instance_set_cpus(&instance, cpu_list) == -1) {
+        fprintf(stderr, "Invalid CPU list '%s'\n", cpu_list);
+        exit(EXIT_FAILURE);
+    }
+    if (cpu_list) worker_cpus = cpu_list;
+    spawn_init(spawn, argv[0], worker_main);
+
+    if ((trace_counters && !trace_path) || (server.capture && !serve)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Bulk jobs run in the foreground and report their own throughput
+    if (bulk.input || bulk.output) {
+        if (!bulk.input || !bulk.output || serve || streaming || use_client || input_file || argc != optind) {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        bulk.workers = server.workers;
+        return run_bulk(&bulk) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    int n_values = argc - optind;
+    if (serve || input_file || streaming) {
+        if (n_values != 0 || serve + !!input_file + streaming + use_client > 1) {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (n_values < 2 || (use_client && n_values != 2)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (server.workers > REDUCE_MAX_WORKERS) server.workers = REDUCE_MAX_WORKERS;
+
+    int nums[2] = {0, 0};
+    if (input_file) {
+        if ((job = load_values(input_file)) == NULL) exit(EXIT_FAILURE);
+    } else if (n_values > 2) {
+        // More than a pair: the daemon reduces the whole input in parallel
+        if ((job = reduce_job_create(n_values)) == NULL) {
+            fprintf(stderr, "Cannot map %d values\n", n_values);
+            exit(EXIT_FAILURE);
+        }
+        int *data = reduce_job_data(job);
+        for (int i = 0; i < n_values; i++) data[i] = parse_arg(argv[optind + i]);
+    } else if (n_values == 2) {
+        nums[0] = parse_arg(argv[optind]);
+        nums[1] = parse_arg(argv[optind + 1]);
+    }
+
+    // The client talks to an already running daemon and stays in the foreground
+    if (use_client) {
+        client *conn = client_connect_to(instance.name);
+        if (conn == NULL) exit(EXIT_FAILURE);
+        int larger;
+        int rc = client_compare(conn, nums[0], nums[1], &larger);
+        if (rc == CLIENT_OK) {
+            printf("The larger number is: %d\n", larger);
+        } else {
+            fprintf(stderr, "%s\n", client_strerror(rc));
+        }
+        client_close(conn);
+        return rc == CLIENT_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     setvbuf(stdout, NULL, _IOLBF, 0);  // Line buffering
     setvbuf(stderr, NULL, _IOLBF, 0);  // Line buffering
 
     // Become daemon
-    if (become_daemon() == -1) {
+    if (become_daemon(job ? reduce_job_fd(job) : -1) == -1) {
         fprintf(stderr, "Failed to create daemon\n");
         exit(EXIT_FAILURE);
     } else {
@@ -233,8 +782,42 @@ int main(int argc, char *argv[]) {
         sigaction(SIGTERM, &dsa, NULL);
     }
 
-    
-    
+    // Set up SIGCHLD handler
+    struct sigaction sa;
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+        fprintf(stderr, "sigaction failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Opened only now: becoming a daemon closed every other descriptor
+    if (trace_path && trace_open(trace_path, trace_counters) == -1) {
+        fprintf(stderr, "Cannot write trace %s: %s\n", trace_path, strerror(errno));
+    }
+    if (fault_enabled()) printf("Fault injection on: %s\n", getenv(FAULT_ENV));
+    limits_init(instance.name);
+
+    if (serve || streaming) {
+        int rc = serve ? run_server(&server) : run_stream(&stream);
+        limits_report(stdout);
+        limits_cleanup();
+        return rc == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (mode == EXEC_THREAD) {
+        int rc = job ? run_thread_reduce(job, server.workers) : run_thread_pipeline(nums);
+        if (job) log_reduce_result(job);
+        if (rc == -1) {
+            fprintf(stderr, "thread pipeline failed\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Daemon exiting\n");
+        fflush(stdout);
+        return EXIT_SUCCESS;
+    }
+
     // Create FIFOs
     unlink(FIFO1);
     unlink(FIFO2);
@@ -243,78 +826,64 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "mkfifo FIFO1 failed\n");
         exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "fifo1 created successfully\n");
+    fprintf(stderr, "%s created successfully\n", FIFO1);
 
     if (mkfifo(FIFO2, 0666) < 0) {
         fprintf(stderr, "mkfifo FIFO2 failed\n");
         unlink(FIFO1);
         exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "fifo2 created successfully\n");
+    fprintf(stderr, "%s created successfully\n", FIFO2);
 
-     // Set up SIGCHLD handler
-    struct sigaction sa;
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGCHLD, &sa, NULL) < 0) {
-        fprintf(stderr, "sigaction failed\n");
-        unlink(FIFO1);
-        unlink(FIFO2);
-        exit(EXIT_FAILURE);
-    }
-
-    // Fork child processes
-    pid_t child1 = fork();
-    if (child1 == 0) {
-        child_process1();
-    } else if (child1 == -1) {
-        fprintf(stderr, "fork failed for child1\n");
-        unlink(FIFO1);
-        unlink(FIFO2);
-        exit(EXIT_FAILURE);
-    } else {
-        if (num_children < MAX_CHILDREN) {
-            child_table[num_children].pid = child1;
-            child_table[num_children].start_time = time(NULL);
-            child_table[num_children].timed_out = 0;
-            num_children++;
+    // Start child processes; a reduce job replaces child 1 with a pool
+    pid_t child1 = -1;
+    int n_stage1 = job ? server.workers : 1;
+    for (int i = 0; i < n_stage1; i++) {
+        child1 = job ? start_worker("reduce", i, reduce_job_fd(job), NULL)
+                     : start_worker("child1", i, -1, NULL);
+        if (child1 == -1) {
+            fprintf(stderr, "Cannot start child1: %s\n", strerror(errno));
+            unlink(FIFO1);
+            unlink(FIFO2);
+            exit(EXIT_FAILURE);
         }
+        track_child(child1, 0);
     }
     
-    pid_t child2 = fork();
-    if (child2 == 0) {
-        child_process2();
-    } else if (child2 == -1) {
-        fprintf(stderr, "fork failed for child2\n");
+    pid_t child2 = start_worker("child2", 0, -1, NULL);
+    if (child2 == -1) {
+        fprintf(stderr, "Cannot start child2: %s\n", strerror(errno));
         unlink(FIFO1);
         unlink(FIFO2);
         exit(EXIT_FAILURE);
-    } else {
-        if (num_children < MAX_CHILDREN) {
-            child_table[num_children].pid = child2;
-            child_table[num_children].start_time = time(NULL);
-            child_table[num_children].timed_out = 0;
-            num_children++;
-        }
     }
+    track_child(child2, 0);
     
-    total_children = 2;
+    total_children = n_stage1 + 1;
+    spawn_stats ss = spawn_get_stats();
     printf("Daemon started. Child PIDs: %d, %d\n", child1, child2);
+    printf("Started %ld children by %s: mean %.1f us, max %.1f us\n", ss.spawned,
+           spawn_method_name(spawn), ss.call_ns / 1e3 / ss.spawned, ss.call_max_ns / 1e3);
     fflush(stdout);
-    // Parent (daemon) writes to FIFO1
-    int fd1 = open(FIFO1, O_WRONLY);
-    if (fd1 == -1) {
-        fprintf(stderr, "open FIFO1 failed");
-        exit(EXIT_FAILURE);
-    }
-    
-    int nums[2] = {atoi(argv[1]), atoi(argv[2])};
-    if (write(fd1, nums, sizeof(nums)) == -1) {
-        fprintf(stderr, "write to FIFO1 failed");
-        exit(EXIT_FAILURE);
+
+    // Parent (daemon) writes to FIFO1; reduce workers already share the input
+    if (job == NULL) {
+        trace_mark mark;
+        trace_begin(&mark, 1);
+        int fd1 = open(FIFO1, O_WRONLY);
+        if (fd1 == -1) {
+            fprintf(stderr, "open FIFO1 failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if (write(fd1, nums, sizeof(nums)) == -1) {
+            fprintf(stderr, "write to FIFO1 failed");
+            exit(EXIT_FAILURE);
+        }
+        close(fd1);
+        trace_end("enqueue", &mark, 0, 0);
+        trace_flush();
     }
-    close(fd1);
 
    
     while (child_count < total_children) {
@@ -325,6 +894,11 @@ int main(int argc, char *argv[]) {
         sleep(2);
     }
 
+    if (job) log_reduce_result(job);
+    trace_flush();
+    limits_report(stdout);
+    limits_cleanup();
+
     // Cleanup
     unlink(FIFO1);
     unlink(FIFO2);
@@ -10,88 +10,153 @@
 #include <time.h>
 #include <string.h>
 #include <errno.h>
-#include <signal.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
+#include <stdatomic.h>
+
 #define FIFO1 "fifo1"
 #define FIFO2 "fifo2"
 #define LOG_FILE "daemon_log.txt"
 #define CHILD_TIMEOUT 30  // 30 seconds timeout
 #define MAX_CHILDREN 10
+#define SEQ_READ_RETRIES 64  // Give up on a slot that keeps changing under us
+
+// Slot states; only the owner of a BUSY slot may touch its fields
+enum { SLOT_FREE = 0, SLOT_BUSY, SLOT_LIVE };
 
-// Structure to track child processes
+// Stable copy of a registry slot handed out to readers
 typedef struct {
     pid_t pid;
     time_t start_time;
+    unsigned gen;  // Sequence number the copy was taken at
 } child_process;
 
+// One registry slot. `seq` is a seqlock: odd while a writer updates the
+// fields, bumped by two per claim/release so it doubles as a generation.
+typedef struct {
+    atomic_uint seq;
+    atomic_int state;
+    atomic_int pid;
+    atomic_llong start_time;
+} child_slot;
+
 // Shared memory structure
 typedef struct {
-    child_process children[MAX_CHILDREN];
-    int num_children;
+    child_slot children[MAX_CHILDREN];
+    atomic_int num_children;  // Live slots, for reporting only
 } shared_data;
 
 volatile sig_atomic_t child_count = 0;
 volatile sig_atomic_t total_children = 0;
 pid_t daemon_pid = 0;
 int shmid = -1;
+shared_data *shared = NULL;  // Attached once, inherited across fork
 int daemon_pipe[2];
 
+// Writer side of the seqlock; caller must own the slot (state BUSY)
+static void slot_write(child_slot *slot, pid_t pid, time_t start_time) {
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->pid, pid, memory_order_relaxed);
+    atomic_store_explicit(&slot->start_time, start_time, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+}
+
+// Lock-free reader. Returns 0 with a consistent copy of a live slot, -1 if
+// the slot is free, being written, or kept changing for SEQ_READ_RETRIES.
+// Never spins unbounded, so it is safe from a handler that interrupted a writer.
+int registry_read(const child_slot *slot, child_process *out) {
+    for (int tries = 0; tries < SEQ_READ_RETRIES; tries++) {
+        unsigned s1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (s1 & 1) continue;
+        int state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+        out->pid = atomic_load_explicit(&slot->pid, memory_order_relaxed);
+        out->start_time = atomic_load_explicit(&slot->start_time, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        unsigned s2 = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        if (s1 == s2) {
+            out->gen = s1;
+            return state == SLOT_LIVE ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+// Claim a free slot for a new child. Async-signal-safe, returns slot index or -1.
+int registry_claim(pid_t pid, time_t start_time) {
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        child_slot *slot = &shared->children[i];
+        int expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&slot->state, &expected, SLOT_BUSY)) {
+            slot_write(slot, pid, start_time);
+            atomic_store_explicit(&slot->state, SLOT_LIVE, memory_order_release);
+            atomic_fetch_add(&shared->num_children, 1);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Release the slot holding `pid`. If `gen` is non-zero the slot is only
+// released when it has not been recycled since that generation was read.
+// Async-signal-safe, returns 0 if this call released the slot.
+int registry_release(pid_t pid, unsigned gen) {
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        child_slot *slot = &shared->children[i];
+        child_process entry;
+        if (registry_read(slot, &entry) == -1 || entry.pid != pid) continue;
+        if (gen != 0 && entry.gen != gen) continue;
+
+        int expected = SLOT_LIVE;
+        if (!atomic_compare_exchange_strong(&slot->state, &expected, SLOT_BUSY)) continue;
+        slot_write(slot, 0, 0);
+        atomic_store_explicit(&slot->state, SLOT_FREE, memory_order_release);
+        atomic_fetch_sub(&shared->num_children, 1);
+        return 0;
+    }
+    return -1;
+}
+
 // Signal handler for SIGCHLD
 void sigchld_handler(int sig) {
     (void)sig;
     int status;
     pid_t pid;
     char buf[100];
-    
-    // Attach to shared memory
-    shared_data *shared = shmat(shmid, NULL, 0);
-    if (shared == (void*)-1) {
-        write(STDERR_FILENO, "Failed to attach shared memory in SIGCHLD handler\n", 48);
-        return;
-    }
+    int saved_errno = errno;
 
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        // Remove from tracking
-        for (int i = 0; i < shared->num_children; i++) {
-            if (shared->children[i].pid == pid) {
-                // Enhanced exit status reporting
-                if (WIFEXITED(status)) {
-                    snprintf(buf, sizeof(buf), 
-                            "Child %d exited normally with status %d\n",
-                            pid, WEXITSTATUS(status));
-                } 
-                else if (WIFSIGNALED(status)) {
-                    snprintf(buf, sizeof(buf),
-                            "Child %d killed by signal %d (%s)\n",
-                            pid, WTERMSIG(status), strsignal(WTERMSIG(status)));
-                }
-                else if (WIFSTOPPED(status)) {
-                    snprintf(buf, sizeof(buf),
-                            "Child %d stopped by signal %d\n",
-                            pid, WSTOPSIG(status));
-                }
-                write(STDOUT_FILENO, buf, strlen(buf));
-                child_count++;
-                // Shift array down
-                memmove(&shared->children[i], &shared->children[i+1],
-                       (shared->num_children - i - 1) * sizeof(child_process));
-                shared->num_children--;
-                break;
-            }
+        // Remove from tracking; the reaper is the only one that frees slots,
+        // so a miss means an untracked child (the daemon's first fork)
+        if (registry_release(pid, 0) == -1) continue;
+
+        // Enhanced exit status reporting
+        if (WIFEXITED(status)) {
+            snprintf(buf, sizeof(buf),
+                    "Child %d exited normally with status %d\n",
+                    pid, WEXITSTATUS(status));
         }
-        
+        else if (WIFSIGNALED(status)) {
+            snprintf(buf, sizeof(buf),
+                    "Child %d killed by signal %d (%s)\n",
+                    pid, WTERMSIG(status), strsignal(WTERMSIG(status)));
+        }
+        else if (WIFSTOPPED(status)) {
+            snprintf(buf, sizeof(buf),
+                    "Child %d stopped by signal %d\n",
+                    pid, WSTOPSIG(status));
+        }
+        write(STDOUT_FILENO, buf, strlen(buf));
+        child_count++;
     }
-    
+
     // Handle waitpid errors (except ECHILD which means no children)
     if (pid == -1 && errno != ECHILD) {
         snprintf(buf, sizeof(buf), "waitpid error: %s\n", strerror(errno));
         write(STDERR_FILENO, buf, strlen(buf));
     }
-    
-    // Detach from shared memory
-    shmdt(shared);
+    errno = saved_errno;
 }
 
 
@@ -129,41 +194,32 @@ void daemon_signal_handler(int sig) {
     }
 }
 
-// Timeout checking function
+// Timeout checking function. Reads the registry without locks while the
+// parent claims and releases slots; the generation taken with each snapshot
+// keeps us from escalating against a slot that was recycled meanwhile.
 void check_timeouts() {
-    shared_data *shared = shmat(shmid, NULL, 0);
-    if (shared == (void*)-1) {
-        write(STDERR_FILENO, "Failed to attach shared memory for timeout check\n", 50);
-        return;
-    }
-
     time_t now = time(NULL);
-    
-    for (int i = 0; i < shared->num_children; i++) {
-        if (now - shared->children[i].start_time > CHILD_TIMEOUT) {
-            pid_t pid = shared->children[i].pid;
-            
-            char buf[100];
-            snprintf(buf, sizeof(buf), "Terminating stalled child PID %d\n", pid);
-            write(STDERR_FILENO, buf, strlen(buf));
-
-            kill(pid, SIGTERM);
-            sleep(1);  // Grace period
-            
-            if (waitpid(pid, NULL, WNOHANG) == 0) {
-                kill(pid, SIGKILL);
-                waitpid(pid, NULL, 0);
-            }
-            
-            // Remove from tracking
-            memmove(&shared->children[i], &shared->children[i+1],
-                   (shared->num_children - i - 1) * sizeof(child_process));
-            shared->num_children--;
-            i--;
+
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        child_slot *slot = &shared->children[i];
+        child_process entry;
+        if (registry_read(slot, &entry) == -1) continue;
+        if (now - entry.start_time <= CHILD_TIMEOUT) continue;
+
+        char buf[100];
+        snprintf(buf, sizeof(buf), "Terminating stalled child PID %d\n", entry.pid);
+        write(STDERR_FILENO, buf, strlen(buf));
+
+        kill(entry.pid, SIGTERM);
+        sleep(1);  // Grace period
+
+        // Still the same child in the same slot: it ignored SIGTERM
+        child_process again;
+        if (registry_read(slot, &again) == 0 && again.gen == entry.gen) {
+            kill(entry.pid, SIGKILL);
         }
+        // The slot itself is freed by the parent when it reaps the child
     }
-    
-    shmdt(shared);
 }
 
 int become_daemon() {
@@ -309,15 +365,15 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Initialize shared memory
-    shared_data *shared = shmat(shmid, NULL, 0);
+    // Initialize shared memory; the mapping stays attached so the daemon
+    // and the signal handlers never have to call shmat() again
+    shared = shmat(shmid, NULL, 0);
     if (shared == (void*)-1) {
         perror("shmat failed");
         shmctl(shmid, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     }
     memset(shared, 0, sizeof(shared_data));
-    shmdt(shared);
 
     int log_fd = open(LOG_FILE, O_WRONLY|O_CREAT|O_APPEND, 0644);
     if (log_fd == -1) {
@@ -404,7 +460,13 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // SIGCHLD stays blocked between fork() and registry_claim()
+    sigset_t chld_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+
     // Create child processes
+    sigprocmask(SIG_BLOCK, &chld_mask, NULL);
     pid_t child1 = fork();
     if (child1 == -1) {
         fprintf(stderr, "fork failed for child1\n");
@@ -413,18 +475,17 @@ int main(int argc, char *argv[]) {
         shmctl(shmid, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     } else if (child1 == 0) {
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
         child_process1();
     } else {
-        // Add to shared memory
-        shared = shmat(shmid, NULL, 0);
-        if (shared != (void*)-1 && shared->num_children < MAX_CHILDREN) {
-            shared->children[shared->num_children].pid = child1;
-            shared->children[shared->num_children].start_time = time(NULL);
-            shared->num_children++;
-            shmdt(shared);
+        // Register before SIGCHLD can try to release the slot
+        if (registry_claim(child1, time(NULL)) == -1) {
+            fprintf(stderr, "Child table full, PID %d not tracked\n", child1);
         }
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
     }
 
+    sigprocmask(SIG_BLOCK, &chld_mask, NULL);
     pid_t child2 = fork();
     if (child2 == -1) {
         fprintf(stderr, "fork failed for child2\n");
@@ -433,16 +494,14 @@ int main(int argc, char *argv[]) {
         shmctl(shmid, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     } else if (child2 == 0) {
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
         child_process2();
     } else {
-        // Add to shared memory
-        shared = shmat(shmid, NULL, 0);
-        if (shared != (void*)-1 && shared->num_children < MAX_CHILDREN) {
-            shared->children[shared->num_children].pid = child2;
-            shared->children[shared->num_children].start_time = time(NULL);
-            shared->num_children++;
-            shmdt(shared);
+        // Register before SIGCHLD can try to release the slot
+        if (registry_claim(child2, time(NULL)) == -1) {
+            fprintf(stderr, "Child table full, PID %d not tracked\n", child2);
         }
+        sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
     }
 
     total_children = 2;
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include "parse_int.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PARSE_SWAR 1
+#endif
+
+#define ASCII_ZEROS 0x3030303030303030ULL
+
+static int is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Length of the digit run at p, looking at no more than avail bytes
+static size_t digit_run(const char *p, size_t avail) {
+    size_t n = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    while (avail - n >= 16) {
+        // c - '0' <= 9 as unsigned bytes marks a digit
+        __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(p + n)), zero);
+        __m128i digits = _mm_cmpeq_epi8(_mm_min_epu8(v, nine), v);
+        unsigned mask = (unsigned)_mm_movemask_epi8(digits);
+        if (mask != 0xFFFF) return n + (size_t)__builtin_ctz(~mask);
+        n += 16;
+    }
+#endif
+    while (n < avail && is_digit(p[n])) n++;
+    return n;
+}
+
+#ifdef PARSE_SWAR
+// Eight ASCII digits in one little-endian word, most significant first
+static uint32_t parse_eight(uint64_t w) {
+    w -= ASCII_ZEROS;
+    w = (w * 10) + (w >> 8);
+    w = (((w & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((w >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)w;
+}
+#endif
+
+#ifdef PARSE_SWAR
+// Word holding the first len (1..8) digits at p, right-aligned behind '0's
+static uint64_t load_digits(const char *p, size_t len) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    if (len < 8) {
+        unsigned shift = 8 * (8 - (unsigned)len);
+        w = (w << shift) | (ASCII_ZEROS >> (64 - shift));
+    }
+    return w;
+}
+#endif
+
+// Value of len (1..16) digits at p; avail bytes may be read from p
+static uint64_t digits_value(const char *p, size_t len, size_t avail) {
+#ifdef PARSE_SWAR
+    if (avail >= 16 || (len <= 8 && avail >= 8)) {
+        if (len <= 8) return parse_eight(load_digits(p, len));
+        return parse_eight(load_digits(p, len - 8)) * 100000000ULL +
+               parse_eight(load_digits(p + len - 8, 8));
+    }
+#else
+    (void)avail;
+#endif
+    uint64_t v = 0;
+    while (len--) v = v * 10 + (uint64_t)(*p++ - '0');
+    return v;
+}
+
+int parse_int32(const char **pp, const char *end, char sep, int *out) {
+    const char *p = *pp;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    size_t len = digit_run(p, (size_t)(end - p));
+    const char *after = p + len;
+    if (after < end && !is_space(*after) && !(sep && *after == sep)) {
+        return PARSE_INVALID;
+    }
+    if (len == 0) return PARSE_EMPTY;
+
+    // Up to 16 digits convert exactly; only longer runs need their
+    // leading zeros dropped before the range check
+    if (len > 16) {
+        while (len > 1 && *p == '0') {
+            p++;
+            len--;
+        }
+        if (len > 10) return PARSE_OVERFLOW;
+    }
+
+    uint64_t v = digits_value(p, len, (size_t)(end - p));
+    if (v > (uint64_t)INT_MAX + (uint64_t)neg) return PARSE_OVERFLOW;
+
+    *out = neg ? (int)(-(int64_t)v) : (int)v;
+    *pp = after;
+    return PARSE_OK;
+}
+
+int parse_int_arg(const char *s, int *out) {
+    const char *end = s + strlen(s);
+    int rc = parse_int32(&s, end, 0, out);
+    if (rc == PARSE_OK && s != end) rc = PARSE_INVALID;  // Trailing blanks
+    return rc;
+}
+
+const char *parse_strerror(int err) {
+    switch (err) {
+        case PARSE_OK: return "ok";
+        case PARSE_EMPTY: return "missing number";
+        case PARSE_INVALID: return "not a decimal integer";
+        case PARSE_OVERFLOW: return "out of int32 range";
+        default: return "parse error";
+    }
+}
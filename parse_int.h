@@ -0,0 +1,27 @@
+#ifndef PARSE_INT_H
+#define PARSE_INT_H
+
+// Decimal int32 parsing for every text input path. The digit run is found
+// 16 bytes at a time with SSE2 and converted 8 digits at a time with SWAR
+// arithmetic; short tails fall back to a scalar loop. Unlike atoi() nothing
+// is silently turned into 0: empty fields, stray characters and values
+// outside the int32 range are reported.
+
+enum {
+    PARSE_OK = 0,
+    PARSE_EMPTY,     // No digits where a number was expected
+    PARSE_INVALID,   // Digits followed by a character that is not a separator
+    PARSE_OVERFLOW   // Does not fit in int32
+};
+
+// Parse "[+-]digits" starting at *pp (leading blanks skipped), reading
+// nothing at or past end. On PARSE_OK *pp points just past the digits.
+// The number must be followed by end, whitespace or `sep` (0 for none).
+int parse_int32(const char **pp, const char *end, char sep, int *out);
+
+// Parse a whole NUL-terminated string such as an argv entry
+int parse_int_arg(const char *s, int *out);
+
+const char *parse_strerror(int err);
+
+#endif
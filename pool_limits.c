@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "pool_limits.h"
+#include "parse_int.h"
+
+#define POOL_NAME_MAX 16
+#define CGROUP_PATH_MAX 512
+
+// ioprio_set() has no glibc wrapper
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct {
+    int cpu_weight;       // 0: not set
+    long long mem_max;    // Bytes, 0: not set
+    int io_weight;
+} pool_limits;
+
+typedef struct {
+    char name[POOL_NAME_MAX];
+    pool_limits limits;        // Overrides of the defaults for this pool
+    int cgroup_ready;          // Its leaf exists with the limits written
+    long started;
+    // Written by limits_reaped(), possibly in a signal handler
+    long reaped;
+    long long utime_us;
+    long long stime_us;
+    long maxrss_kb;            // Largest of its workers
+    long minflt;
+    long majflt;
+} pool;
+
+typedef struct {
+    pid_t pid;
+    int pool;
+    long long utime_us;
+    long long stime_us;
+    long maxrss_kb;
+    long minflt;
+    long majflt;
+} reaped_worker;
+
+typedef enum { MODE_NONE, MODE_CGROUP, MODE_RLIMIT } limits_mode;
+
+static pool_limits defaults;
+static pool pools[LIMITS_MAX_POOLS];
+static int n_pools = 0;
+static struct {
+    volatile pid_t pid;   // 0: free
+    int pool;
+} tracked[LIMITS_MAX_TRACKED];
+static reaped_worker recent[LIMITS_RECENT];
+static volatile long n_recent = 0;
+static limits_mode mode = MODE_NONE;
+static char base_path[CGROUP_PATH_MAX / 2 + 128];  // The cgroup the daemon started in
+static char group_path[CGROUP_PATH_MAX];  // Ours below it
+static char base_enabled[64];  // Controllers we turned on in base_path, "cpu memory "
+static int apply_warned = 0;
+
+static int find_pool(const char *name, int create) {
+    for (int i = 0; i < n_pools; i++) {
+        if (strcmp(pools[i].name, name) == 0) return i;
+    }
+    if (!create || n_pools == LIMITS_MAX_POOLS || strlen(name) >= POOL_NAME_MAX) return -1;
+    memset(&pools[n_pools], 0, sizeof(pools[n_pools]));
+    strcpy(pools[n_pools].name, name);
+    return n_pools++;
+}
+
+static pool_limits effective(const pool *p) {
+    pool_limits l = defaults;
+    if (p->limits.cpu_weight) l.cpu_weight = p->limits.cpu_weight;
+    if (p->limits.mem_max) l.mem_max = p->limits.mem_max;
+    if (p->limits.io_weight) l.io_weight = p->limits.io_weight;
+    return l;
+}
+
+static int any_limits(void) {
+    if (defaults.cpu_weight || defaults.mem_max || defaults.io_weight) return 1;
+    for (int i = 0; i < n_pools; i++) {
+        const pool_limits *l = &pools[i].limits;
+        if (l->cpu_weight || l->mem_max || l->io_weight) return 1;
+    }
+    return 0;
+}
+
+static int parse_item(const char *item, pool_limits *l) {
+    const char *eq = strchr(item, '=');
+    if (eq == NULL) return -1;
+    size_t key_len = (size_t)(eq - item);
+    char value[32];
+    if (snprintf(value, sizeof(value), "%s", eq + 1) >= (int)sizeof(value)) return -1;
+
+    // Bytes need 64 bits: a gigabyte count in int32 stops short of 2g
+    if (key_len == 3 && strncmp(item, "mem", 3) == 0) {
+        long long unit = 1;
+        size_t len = strlen(value);
+        switch (len > 0 ? tolower((unsigned char)value[len - 1]) : 0) {
+            case 'k': unit = 1LL << 10; break;
+            case 'm': unit = 1LL << 20; break;
+            case 'g': unit = 1LL << 30; break;
+            default: break;
+        }
+        if (unit > 1) value[len - 1] = '\0';
+        char *end;
+        errno = 0;
+        long long n = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || errno != 0 || n < 1 || n > LLONG_MAX / unit) return -1;
+        l->mem_max = n * unit;
+        return 0;
+    }
+
+    int n;
+    if (parse_int_arg(value, &n) != PARSE_OK || n < 1) return -1;
+    if (key_len == 3 && strncmp(item, "cpu", 3) == 0 && n <= LIMITS_WEIGHT_MAX) {
+        l->cpu_weight = n;
+    } else if (key_len == 2 && strncmp(item, "io", 2) == 0 && n <= LIMITS_WEIGHT_MAX) {
+        l->io_weight = n;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int limits_parse(const char *spec) {
+    char buf[128];
+    if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf)) return -1;
+
+    pool_limits parsed = { 0, 0, 0 };
+    char *items = buf, *name = NULL;
+    char *colon = strchr(buf, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        name = buf;
+        items = colon + 1;
+        if (*name == '\0') return -1;
+    }
+    char *save;
+    for (char *item = strtok_r(items, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (parse_item(item, &parsed) == -1) return -1;
+    }
+
+    pool_limits *target = &defaults;
+    if (name != NULL) {
+        int i = find_pool(name, 1);
+        if (i == -1) return -1;
+        target = &pools[i].limits;
+    }
+    if (parsed.cpu_weight) target->cpu_weight = parsed.cpu_weight;
+    if (parsed.mem_max) target->mem_max = parsed.mem_max;
+    if (parsed.io_weight) target->io_weight = parsed.io_weight;
+    return 0;
+}
+
+static int write_file(const char *dir, const char *file, const char *text) {
+    char path[CGROUP_PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = write(fd, text, strlen(text));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "re");
+    if (f == NULL) return -1;
+    char *line = fgets(buf, (int)size, f);
+    fclose(f);
+    if (line == NULL) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int move_pid(const char *dir, pid_t pid) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", (int)pid);
+    return write_file(dir, "cgroup.procs", text);
+}
+
+static int pool_dir(const pool *p, char *dir, size_t size) {
+    return snprintf(dir, size, "%s/%s", group_path, p->name) < (int)size ? 0 : -1;
+}
+
+// Where cgroup2 is mounted plus our path in it, from the unified
+// hierarchy's "0::<path>" line
+static int find_base(void) {
+    char mount[128] = "", line[1024];
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strstr(line, " - cgroup2 ");
+        char point[128];
+        if (sep != NULL && sscanf(line, "%*s %*s %*s %*s %127s", point) == 1) {
+            strcpy(mount, point);
+            break;
+        }
+    }
+    fclose(f);
+
+    char own[256] = "";
+    if ((f = fopen("/proc/self/cgroup", "re")) == NULL) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            if (snprintf(own, sizeof(own), "%s", line + 3) >= (int)sizeof(own)) own[0] = '\0';
+            break;
+        }
+    }
+    fclose(f);
+    if (mount[0] == '\0' || own[0] == '\0') return -1;
+    if (strcmp(own, "/") == 0) own[0] = '\0';
+    snprintf(base_path, sizeof(base_path), "%s%s", mount, own);
+    return 0;
+}
+
+// The controllers the configured limits need, as "cpu memory io"
+static void needed_controllers(char *out, size_t size) {
+    int cpu = defaults.cpu_weight != 0, mem = defaults.mem_max != 0, io = defaults.io_weight != 0;
+    for (int i = 0; i < n_pools; i++) {
+        cpu |= pools[i].limits.cpu_weight != 0;
+        mem |= pools[i].limits.mem_max != 0;
+        io |= pools[i].limits.io_weight != 0;
+    }
+    snprintf(out, size, "%s%s%s", cpu ? "cpu " : "", mem ? "memory " : "", io ? "io " : "");
+}
+
+static int has_word(const char *list, const char *word) {
+    size_t len = strlen(word);
+    for (const char *p = list; (p = strstr(p, word)) != NULL; p += len) {
+        if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return 1;
+    }
+    return 0;
+}
+
+// Write "+name" or "-name" for each controller in list to dir's
+// cgroup.subtree_control. Returns 0, or -1 with errno set and *failed
+// naming the controller refused.
+static int switch_controllers(const char *dir, const char *list, char sign, const char **failed) {
+    static char word[16];
+    char copy[64], *save;
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *w = strtok_r(copy, " ", &save); w; w = strtok_r(NULL, " ", &save)) {
+        char text[sizeof(word) + 1];
+        snprintf(word, sizeof(word), "%s", w);
+        snprintf(text, sizeof(text), "%c%s", sign, word);
+        if (write_file(dir, "cgroup.subtree_control", text) == -1) {
+            if (failed) *failed = word;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Undo setup_cgroups, or as much of it as was done: pools first, then the
+// controllers from the bottom up, so the daemon may rejoin the cgroup it
+// started in and its own leaf can go
+static void teardown_cgroups(void) {
+    char path[CGROUP_PATH_MAX + POOL_NAME_MAX], wanted[64];
+    for (int i = 0; i < n_pools; i++) {
+        if (!pools[i].cgroup_ready) continue;
+        if (pool_dir(&pools[i], path, sizeof(path)) == 0) rmdir(path);
+        pools[i].cgroup_ready = 0;
+    }
+    needed_controllers(wanted, sizeof(wanted));
+    switch_controllers(group_path, wanted, '-', NULL);
+    switch_controllers(base_path, base_enabled, '-', NULL);
+    base_enabled[0] = '\0';
+    move_pid(base_path, getpid());
+    snprintf(path, sizeof(path), "%s/daemon", group_path);
+    rmdir(path);
+    rmdir(group_path);
+}
+
+// A non-root cgroup v2 group may hold processes or enable controllers for
+// its children, not both. So the daemon leaves the cgroup it started in
+// for a leaf of its own before any controller is enabled on the way down.
+// That works from the root cgroup, or from a delegated cgroup that held
+// nothing but the daemon.
+static int setup_cgroups(const char *instance_name) {
+    char leaf[CGROUP_PATH_MAX + 16], path[CGROUP_PATH_MAX + 32], on[256], wanted[64];
+    const char *failed = NULL;
+    if (find_base() == -1) {
+        printf("No cgroup v2 hierarchy\n");
+        return -1;
+    }
+    needed_controllers(wanted, sizeof(wanted));
+
+    snprintf(group_path, sizeof(group_path), "%s/daemon%s%s", base_path,
+             instance_name[0] ? "." : "", instance_name);
+    if (mkdir(group_path, 0755) == -1 && errno != EEXIST) {
+        printf("Cannot create cgroup %s: %s\n", group_path, strerror(errno));
+        return -1;
+    }
+    snprintf(leaf, sizeof(leaf), "%s/daemon", group_path);
+    if ((mkdir(leaf, 0755) == -1 && errno != EEXIST) || move_pid(leaf, getpid()) == -1) {
+        printf("Cannot move the daemon into %s: %s\n", leaf, strerror(errno));
+        teardown_cgroups();
+        return -1;
+    }
+
+    // Turn on what the cgroup we started in lacks, and remember it for
+    // teardown; whatever was on already stays on
+    char offered[256], missing[64] = "", *save;
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", base_path);
+    if (read_line(path, offered, sizeof(offered)) == -1) offered[0] = '\0';
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", base_path);
+    if (read_line(path, on, sizeof(on)) == -1) on[0] = '\0';
+    for (char *w = strtok_r(wanted, " ", &save); w; w = strtok_r(NULL, " ", &save)) {
+        if (has_word(on, w)) continue;
+        if (!has_word(offered, w)) {
+            printf("cgroup v2 at %s lacks the %s controller\n", base_path, w);
+            teardown_cgroups();
+            return -1;
+        }
+        strcat(missing, w);
+        strcat(missing, " ");
+    }
+    if (switch_controllers(base_path, missing, '+', &failed) == -1) {
+        printf("Cannot enable %s in %s: %s%s\n", failed, base_path, strerror(errno),
+               errno == EBUSY ? " (other processes live there; start the daemon in a "
+                                "delegated cgroup of its own)" : "");
+        snprintf(base_enabled, sizeof(base_enabled), "%s", missing);  // Some may be on
+        teardown_cgroups();
+        return -1;
+    }
+    snprintf(base_enabled, sizeof(base_enabled), "%s", missing);
+
+    needed_controllers(wanted, sizeof(wanted));
+    if (switch_controllers(group_path, wanted, '+', &failed) == -1) {
+        printf("Cannot enable %s in %s: %s\n", failed, group_path, strerror(errno));
+        teardown_cgroups();
+        return -1;
+    }
+    return 0;
+}
+
+void limits_init(const char *instance_name) {
+    if (!any_limits()) return;
+    if (setup_cgroups(instance_name) == 0) {
+        mode = MODE_CGROUP;
+        printf("Worker pools limited by cgroup v2 under %s\n", group_path);
+    } else {
+        mode = MODE_RLIMIT;
+        printf("Worker limits fall back to nice, RLIMIT_DATA and I/O priority\n");
+    }
+    fflush(stdout);
+}
+
+void limits_cleanup(void) {
+    if (mode == MODE_CGROUP) teardown_cgroups();
+}
+
+static int ready_cgroup(pool *p) {
+    if (p->cgroup_ready) return 0;
+    char dir[CGROUP_PATH_MAX + POOL_NAME_MAX], text[32];
+    if (pool_dir(p, dir, sizeof(dir)) == -1 || (mkdir(dir, 0755) == -1 && errno != EEXIST)) return -1;
+
+    pool_limits l = effective(p);
+    if (l.cpu_weight) {
+        snprintf(text, sizeof(text), "%d", l.cpu_weight);
+        if (write_file(dir, "cpu.weight", text) == -1) return -1;
+    }
+    if (l.mem_max) {
+        snprintf(text, sizeof(text), "%lld", l.mem_max);
+        if (write_file(dir, "memory.max", text) == -1) return -1;
+    }
+    // Only honoured by weight-based I/O schedulers such as BFQ
+    if (l.io_weight) {
+        snprintf(text, sizeof(text), "default %d", l.io_weight);
+        if (write_file(dir, "io.weight", text) == -1) return -1;
+    }
+    p->cgroup_ready = 1;
+    return 0;
+}
+
+// CPU weight 100 is nice 0, and every nice level is worth 1.25 times the
+// CPU of the next, as in the kernel's weight table
+static int weight_to_nice(int weight) {
+    double ratio = weight / (double)LIMITS_WEIGHT_DEFAULT;
+    int nice = 0;
+    while (ratio >= 1.25 && nice > -20) {
+        ratio /= 1.25;
+        nice--;
+    }
+    while (ratio <= 0.8 && nice < 19) {
+        ratio *= 1.25;
+        nice++;
+    }
+    return nice;
+}
+
+// Best-effort class levels 0 (most) to 7, 4 being the default, one level
+// per doubling of the weight
+static int weight_to_ioprio(int weight) {
+    int level = 4;
+    for (int w = weight; w >= 2 * LIMITS_WEIGHT_DEFAULT && level > 0; w /= 2) level--;
+    for (int w = weight; w * 2 <= LIMITS_WEIGHT_DEFAULT && level < 7; w *= 2) level++;
+    return IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | level;
+}
+
+static int apply_rlimits(const pool *p, pid_t pid) {
+    pool_limits l = effective(p);
+    int rc = 0;
+    if (l.cpu_weight && setpriority(PRIO_PROCESS, (id_t)pid, weight_to_nice(l.cpu_weight)) == -1) {
+        rc = -1;
+    }
+    if (l.mem_max) {
+        struct rlimit rl = { (rlim_t)l.mem_max, (rlim_t)l.mem_max };
+        if (prlimit(pid, RLIMIT_DATA, &rl, NULL) == -1) rc = -1;
+    }
+    if (l.io_weight && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)pid,
+                               weight_to_ioprio(l.io_weight)) == -1) {
+        rc = -1;
+    }
+    return rc;
+}
+
+void limits_apply(const char *pool_name, pid_t pid) {
+    int i = find_pool(pool_name, 1);
+    if (i == -1) return;
+    pool *p = &pools[i];
+    p->started++;
+    for (int t = 0; t < LIMITS_MAX_TRACKED; t++) {
+        if (tracked[t].pid == 0) {
+            tracked[t].pool = i;
+            tracked[t].pid = pid;
+            break;
+        }
+    }
+
+    int rc = 0;
+    if (mode == MODE_CGROUP) {
+        char dir[CGROUP_PATH_MAX + POOL_NAME_MAX];
+        rc = pool_dir(p, dir, sizeof(dir)) == -1 || ready_cgroup(p) == -1 ||
+             move_pid(dir, pid) == -1 ? -1 : 0;
+    } else if (mode == MODE_RLIMIT) {
+        rc = apply_rlimits(p, pid);
+    }
+    // ESRCH: it exited already, which is no reason to complain
+    if (rc == -1 && errno != ESRCH && !apply_warned) {
+        printf("Cannot limit %s worker %d: %s\n", p->name, pid, strerror(errno));
+        apply_warned = 1;
+    }
+}
+
+static long long timeval_us(const struct timeval *tv) {
+    return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void limits_reaped(pid_t pid, const struct rusage *ru) {
+    int i = -1;
+    for (int t = 0; t < LIMITS_MAX_TRACKED; t++) {
+        if (tracked[t].pid == pid) {
+            i = tracked[t].pool;
+            tracked[t].pid = 0;
+            break;
+        }
+    }
+    if (i == -1) return;
+
+    pool *p = &pools[i];
+    reaped_worker *r = &recent[n_recent % LIMITS_RECENT];
+    r->pid = pid;
+    r->pool = i;
+    r->utime_us = timeval_us(&ru->ru_utime);
+    r->stime_us = timeval_us(&ru->ru_stime);
+    r->maxrss_kb = ru->ru_maxrss;
+    r->minflt = ru->ru_minflt;
+    r->majflt = ru->ru_majflt;
+    n_recent++;
+
+    p->reaped++;
+    p->utime_us += r->utime_us;
+    p->stime_us += r->stime_us;
+    if (r->maxrss_kb > p->maxrss_kb) p->maxrss_kb = r->maxrss_kb;
+    p->minflt += r->minflt;
+    p->majflt += r->majflt;
+}
+
+void limits_report(FILE *out) {
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);  // A consistent snapshot
+
+    static const char *const mode_names[] = { "no limits", "cgroup v2", "per-process limits" };
+    fprintf(out, "Worker pools (%s), reaped workers' usage:\n", mode_names[mode]);
+    for (int i = 0; i < n_pools; i++) {
+        const pool *p = &pools[i];
+        if (p->started == 0) continue;
+        fprintf(out, "  %s: %ld started, %ld reaped, user %.3f s sys %.3f s, "
+                "peak RSS %ld KiB, faults %ld minor %ld major\n", p->name, p->started, p->reaped,
+                p->utime_us / 1e6, p->stime_us / 1e6, p->maxrss_kb, p->minflt, p->majflt);
+    }
+    long first = n_recent > LIMITS_RECENT ? n_recent - LIMITS_RECENT : 0;
+    for (long n = first; n < n_recent; n++) {
+        const reaped_worker *r = &recent[n % LIMITS_RECENT];
+        fprintf(out, "  PID %d (%s): user %.3f s sys %.3f s, peak RSS %ld KiB, faults %ld/%ld\n",
+                (int)r->pid, pools[r->pool].name, r->utime_us / 1e6, r->stime_us / 1e6,
+                r->maxrss_kb, r->minflt, r->majflt);
+    }
+    fflush(out);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
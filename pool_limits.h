@@ -0,0 +1,50 @@
+#ifndef POOL_LIMITS_H
+#define POOL_LIMITS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Resource isolation and accounting of the worker pools. A pool is every
+// worker started with the same role (compare, output, child1, reduce...).
+// With limits given (-L), each pool gets its own cgroup v2 leaf under
+// <daemon's cgroup>/daemon[.<name>]/ with cpu.weight, memory.max and
+// io.weight set, and the daemon moves into a leaf of its own next to them.
+// Where cgroup v2 or one of its cpu, memory or io controllers is not
+// available, each worker gets the nearest per-process limits instead:
+// a nice value for the CPU weight, RLIMIT_DATA for the memory cap and
+// a best-effort I/O priority for the I/O weight.
+//
+// Either way, the CPU time, peak RSS and page faults of every worker are
+// collected from wait4() when it is reaped, summed per pool and kept for
+// the last LIMITS_RECENT workers, for the metrics.
+
+#define LIMITS_MAX_POOLS 8
+#define LIMITS_MAX_TRACKED 64   // Live workers whose pool is remembered
+#define LIMITS_RECENT 8         // Reaped workers reported one by one
+#define LIMITS_WEIGHT_DEFAULT 100
+#define LIMITS_WEIGHT_MAX 10000
+
+// Add "[pool:]cpu=<weight>,mem=<bytes>[k|m|g],io=<weight>" (any subset,
+// weights 1..10000); without a pool it applies to every pool. Before
+// limits_init. Returns 0, or -1 for a malformed spec.
+int limits_parse(const char *spec);
+
+// In the daemon once it is detached: set up the cgroups when any limit
+// was given, or settle for the fallback and say why
+void limits_init(const char *instance_name);
+
+// Remove the cgroups again once every worker is gone
+void limits_cleanup(void);
+
+// After starting pid for pool (SIGCHLD blocked, so it cannot be reaped
+// first): move it into its cgroup or apply the fallback limits
+void limits_apply(const char *pool, pid_t pid);
+
+// From the SIGCHLD handler or any other reaper; async-signal-safe
+void limits_reaped(pid_t pid, const struct rusage *ru);
+
+// Per-pool totals and the recently reaped workers
+void limits_report(FILE *out);
+
+#endif
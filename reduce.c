@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "reduce.h"
+
+// One mapping: header, tree nodes, arrival counters, then the values. It is
+// backed by a memfd so that workers started by exec can map it too, at
+// whatever address they get, hence offsets rather than pointers.
+struct reduce_job {
+    size_t n;
+    size_t n_chunks;
+    size_t leaves;            // n_chunks rounded up to a power of two
+    size_t map_size;
+    atomic_size_t next_chunk;
+    int fd;
+    size_t nodes_off;         // Heap order: root 1, leaf i at leaves + i
+    size_t arrivals_off;
+    size_t data_off;
+};
+
+#define JOB_AT(job, off) ((char *)(job) + (job)->off)
+#define NODES(job) ((reduce_result *)JOB_AT(job, nodes_off))
+#define ARRIVALS(job) ((atomic_int *)JOB_AT(job, arrivals_off))
+#define DATA(job) ((int *)JOB_AT(job, data_off))
+
+reduce_job *reduce_job_create(size_t n) {
+    size_t n_chunks = n ? (n + REDUCE_CHUNK_ELEMS - 1) / REDUCE_CHUNK_ELEMS : 1;
+    size_t leaves = 1;
+    while (leaves < n_chunks) leaves <<= 1;
+
+    size_t nodes_off = (sizeof(reduce_job) + 63) & ~(size_t)63;
+    size_t arrivals_off = nodes_off + 2 * leaves * sizeof(reduce_result);
+    size_t data_off = (arrivals_off + 2 * leaves * sizeof(atomic_int) + 63) & ~(size_t)63;
+    size_t map_size = data_off + n * sizeof(int);
+
+    int fd = memfd_create("reduce_job", 0);
+    if (fd == -1) return NULL;
+    if (ftruncate(fd, (off_t)map_size) == -1) {
+        close(fd);
+        return NULL;
+    }
+    char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    // Fresh memfd pages are already zero: no arrivals, empty nodes
+    reduce_job *job = (reduce_job *)base;
+    job->n = n;
+    job->n_chunks = n_chunks;
+    job->leaves = leaves;
+    job->map_size = map_size;
+    atomic_init(&job->next_chunk, 0);
+    job->fd = fd;
+    job->nodes_off = nodes_off;
+    job->arrivals_off = arrivals_off;
+    job->data_off = data_off;
+    return job;
+}
+
+reduce_job *reduce_job_attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(reduce_job)) return NULL;
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+int reduce_job_fd(const reduce_job *job) {
+    return job->fd;
+}
+
+void reduce_job_destroy(reduce_job *job) {
+    int fd = job->fd;
+    munmap(job, job->map_size);
+    close(fd);
+}
+
+int *reduce_job_data(reduce_job *job) {
+    return DATA(job);
+}
+
+size_t reduce_job_size(const reduce_job *job) {
+    return job->n;
+}
+
+void reduce_range(const int *v, size_t n, size_t base, reduce_result *out) {
+    memset(out, 0, sizeof(*out));
+    if (n == 0) return;
+
+    // Branch-free loop the compiler can vectorize; argmax is found in a
+    // second pass over the same, still cache-hot, chunk
+    int mx = v[0], mn = v[0];
+    long long sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        mx = v[i] > mx ? v[i] : mx;
+        mn = v[i] < mn ? v[i] : mn;
+        sum += v[i];
+    }
+    size_t arg = 0;
+    while (v[arg] != mx) arg++;
+
+    out->max = mx;
+    out->min = mn;
+    out->sum = sum;
+    out->argmax = base + arg;
+    out->count = n;
+}
+
+// Fold right into left; on equal maxima the left (lower) index wins
+static void merge(const reduce_result *left, const reduce_result *right, reduce_result *out) {
+    if (left->count == 0) { *out = *right; return; }
+    if (right->count == 0) { *out = *left; return; }
+
+    reduce_result r;
+    r.max = right->max > left->max ? right->max : left->max;
+    r.argmax = right->max > left->max ? right->argmax : left->argmax;
+    r.min = right->min < left->min ? right->min : left->min;
+    r.sum = left->sum + right->sum;
+    r.count = left->count + right->count;
+    *out = r;
+}
+
+// Whether any real chunk sits below this tree node
+static int subtree_used(const reduce_job *job, size_t node) {
+    while (node < job->leaves) node <<= 1;
+    return node - job->leaves < job->n_chunks;
+}
+
+// Carry a finished node towards the root. Returns 1 after writing the root.
+static int climb(reduce_job *job, size_t node) {
+    while (node > 1) {
+        size_t sibling = node ^ 1;
+        size_t parent = node >> 1;
+
+        if (!subtree_used(job, sibling)) {
+            NODES(job)[parent] = NODES(job)[node];
+        } else {
+            // First to arrive leaves the merge to its sibling
+            if (atomic_fetch_add_explicit(&ARRIVALS(job)[parent], 1, memory_order_acq_rel) == 0) {
+                return 0;
+            }
+            size_t left = node < sibling ? node : sibling;
+            merge(&NODES(job)[left], &NODES(job)[left + 1], &NODES(job)[parent]);
+        }
+        node = parent;
+    }
+    return 1;
+}
+
+int reduce_worker(reduce_job *job) {
+    int finished_root = 0;
+    for (;;) {
+        size_t chunk = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (chunk >= job->n_chunks) break;
+
+        size_t start = chunk * REDUCE_CHUNK_ELEMS;
+        size_t len = job->n - start < REDUCE_CHUNK_ELEMS ? job->n - start : REDUCE_CHUNK_ELEMS;
+        reduce_range(DATA(job) + start, len, start, &NODES(job)[job->leaves + chunk]);
+
+        if (climb(job, job->leaves + chunk)) finished_root = 1;
+    }
+    return finished_root;
+}
+
+reduce_result reduce_job_result(const reduce_job *job) {
+    return NODES(job)[1];
+}
+
+void reduce_pin_worker(int index) {
+    cpu_set_t allowed, mine;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return;
+
+    int n_allowed = CPU_COUNT(&allowed);
+    if (n_allowed <= 1) return;
+
+    int want = index % n_allowed;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (want-- == 0) {
+            CPU_ZERO(&mine);
+            CPU_SET(cpu, &mine);
+            sched_setaffinity(0, sizeof(mine), &mine);
+            return;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Parallel reduction of a large input. The values live in a shared mapping,
+// workers claim cache-sized chunks and fold the partial results up a
+// combining tree: the second child to finish merges both halves into the
+// parent, so the worker completing the root holds the final answer.
+
+#define REDUCE_CHUNK_ELEMS 8192   // 32 KiB of ints, stays resident in L1/L2
+#define REDUCE_MAX_WORKERS 8
+
+typedef struct {
+    int max;
+    int min;
+    long long sum;
+    size_t argmax;  // First index holding max
+    size_t count;   // Values covered, 0 for an empty node
+} reduce_result;
+
+typedef struct reduce_job reduce_job;
+
+// Map a job for n values shared with forked children. NULL on failure.
+reduce_job *reduce_job_create(size_t n);
+void reduce_job_destroy(reduce_job *job);
+
+// Map the job behind an inherited reduce_job_fd() in a worker started by
+// exec. NULL on failure.
+reduce_job *reduce_job_attach(int fd);
+int reduce_job_fd(const reduce_job *job);
+
+// Input buffer of the job, to be filled before any worker starts
+int *reduce_job_data(reduce_job *job);
+size_t reduce_job_size(const reduce_job *job);
+
+// Claim and reduce chunks until none are left. Returns 1 in the one worker
+// that completed the root, 0 in all others.
+int reduce_worker(reduce_job *job);
+
+// Final result, valid after reduce_worker returned 1 somewhere
+reduce_result reduce_job_result(const reduce_job *job);
+
+// Single-threaded reduction of v[0..n); base is the index of v[0]
+void reduce_range(const int *v, size_t n, size_t base, reduce_result *out);
+
+// Pin the calling process or thread to one CPU, spreading workers out
+void reduce_pin_worker(int index);
+
+#endif
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "server.h"
+#include "client.h"
+#include "capture.h"
+#include "parse_int.h"
+
+// Sends a traffic capture (capture.h) back through running servers: every
+// recorded request with its operands, priority class and the deadline it
+// had left on arrival, at the pace it arrived, a multiple of it (-s) or as
+// fast as the servers take it (-s 0). All of it leaves from this one
+// process, whichever clients sent it originally. Answers are checked and
+// timed, and so is how far the replay fell behind the recorded schedule.
+
+#define REPLAY_BUCKETS 640     // Latency histogram, about 6% resolution
+#define REPLAY_LATE_US 1000    // Sent this far behind schedule counts as late
+
+typedef struct replay_request {
+    long long sent_us;
+    int expected;
+    struct replay_request *next_free;
+} replay_request;
+
+typedef struct {
+    long sent;
+    long ok;
+    long wrong;
+    long expired;
+    long failed;
+    int first_error;
+    long late;
+    long long max_behind_us;
+    long hist[REPLAY_BUCKETS];
+} replay_stats;
+
+static replay_stats stats;
+static replay_request *free_reqs;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-i name[,name...] | -D] [-s speed] [-d depth] [-n count] [-N] <capture>\n", prog);
+    fprintf(stderr, "  -i names  daemon instances to route over (default: the unnamed one)\n");
+    fprintf(stderr, "  -D        route over every instance in the working directory\n");
+    fprintf(stderr, "  -s speed  multiple of the recorded pace, 0 for flat out (default 1)\n");
+    fprintf(stderr, "  -d depth  requests kept in flight at most (default %d)\n", CLIENT_MAX_INFLIGHT / 4);
+    fprintf(stderr, "  -n count  replay only the first count requests\n");
+    fprintf(stderr, "  -N        leave out the recorded deadlines\n");
+}
+
+static int parse_arg(const char *arg) {
+    int value;
+    int rc = parse_int_arg(arg, &value);
+    if (rc != PARSE_OK || value < 0) {
+        fprintf(stderr, "Invalid number '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Exact below 32 us, then 16 buckets per power of two
+static int bucket_of(long long us) {
+    if (us < 32) return us < 0 ? 0 : (int)us;
+    int exp = 63 - __builtin_clzll((unsigned long long)us);
+    int b = 32 + (exp - 5) * 16 + (int)((us >> (exp - 4)) & 15);
+    return b < REPLAY_BUCKETS ? b : REPLAY_BUCKETS - 1;
+}
+
+static long long bucket_top(int b) {
+    if (b < 32) return b;
+    int exp = 5 + (b - 32) / 16;
+    return ((16LL + (b - 32) % 16 + 1) << (exp - 4)) - 1;
+}
+
+static double percentile_ms(double pct) {
+    long want = (long)(stats.ok * pct / 100.0), seen = 0;
+    for (int b = 0; b < REPLAY_BUCKETS; b++) {
+        seen += stats.hist[b];
+        if (seen > want) return bucket_top(b) / 1e3;
+    }
+    return 0.0;
+}
+
+static void request_done(void *arg, int status, int larger) {
+    replay_request *req = arg;
+    if (status == CLIENT_OK) {
+        if (larger == req->expected) {
+            stats.ok++;
+            stats.hist[bucket_of(monotonic_us() - req->sent_us)]++;
+        } else {
+            stats.wrong++;
+        }
+    } else if (status == CLIENT_ERR_EXPIRED) {
+        stats.expired++;
+    } else if (stats.failed++ == 0) {
+        stats.first_error = status;
+    }
+    req->next_free = free_reqs;
+    free_reqs = req;
+}
+
+// Collect answers until the schedule reaches target_us. Returns how far
+// behind it we already are, 0 when on time.
+static long long wait_until(client_pool *pool, long long target_us) {
+    long long now;
+    while ((now = monotonic_us()) < target_us && !stopping) {
+        long long left = target_us - now;
+        if (client_pool_inflight(pool) > 0 && left >= 1000) {
+            client_pool_poll(pool, (int)(left / 1000));
+            continue;
+        }
+        if (client_pool_inflight(pool) > 0) client_pool_poll(pool, 0);
+        struct timespec ts = { (time_t)(left / 1000000), (long)(left % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+    return now > target_us ? now - target_us : 0;
+}
+
+int main(int argc, char *argv[]) {
+    char *instances = NULL;
+    int discover = 0;
+    double speed = 1.0;
+    int depth = CLIENT_MAX_INFLIGHT / 4;
+    long limit = -1;
+    int keep_deadlines = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:Ds:d:n:N")) != -1) {
+        switch (opt) {
+            case 'i':
+                instances = optarg;
+                break;
+            case 'D':
+                discover = 1;
+                break;
+            case 's': {
+                char *end;
+                speed = strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || !(speed >= 0 && speed <= 1e6)) {
+                    fprintf(stderr, "Invalid speed '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'd':
+                depth = parse_arg(optarg);
+                break;
+            case 'n':
+                limit = parse_arg(optarg);
+                break;
+            case 'N':
+                keep_deadlines = 0;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1 || depth < 1 || depth > CLIENT_MAX_INFLIGHT || (instances && discover)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    capture_trace trace;
+    if (capture_map(argv[optind], &trace) == -1) return EXIT_FAILURE;
+    size_t count = limit >= 0 && (size_t)limit < trace.count ? (size_t)limit : trace.count;
+    double span = count > 0 ? trace.records[count - 1].ns / 1e9 : 0.0;
+    time_t captured = (time_t)trace.hdr->start_unix;
+    printf("Capture of %zu requests over %.3f s, started %s", trace.count,
+           trace.count > 0 ? trace.records[trace.count - 1].ns / 1e9 : 0.0, ctime(&captured));
+    if (trace.hdr->dropped > 0) {
+        printf("  %llu more requests arrived after the capture was full\n",
+               (unsigned long long)trace.hdr->dropped);
+    }
+
+    client_pool *pool = client_pool_create();
+    if (pool == NULL) return EXIT_FAILURE;
+    if (discover) {
+        client_pool_discover(pool);
+    } else if (instances) {
+        for (char *name = strtok(instances, ","); name; name = strtok(NULL, ",")) {
+            client_pool_join(pool, name);
+        }
+    } else {
+        client_pool_join(pool, NULL);
+    }
+    if (client_pool_size(pool) == 0) {
+        fprintf(stderr, "No server instance to talk to\n");
+        client_pool_destroy(pool);
+        capture_unmap(&trace);
+        return EXIT_FAILURE;
+    }
+
+    replay_request *reqs = calloc((size_t)depth, sizeof(*reqs));
+    if (reqs == NULL) {
+        fprintf(stderr, "Cannot allocate %d requests\n", depth);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < depth; i++) reqs[i].next_free = i + 1 < depth ? &reqs[i + 1] : NULL;
+    free_reqs = reqs;
+    stats.first_error = CLIENT_OK;
+
+    struct sigaction sa;
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int priority = WIRE_PRIO_INTERACTIVE, deadline_ms = 0;
+    long long start = monotonic_us();
+    for (size_t i = 0; i < count && !stopping; i++) {
+        const capture_record *rec = &trace.records[i];
+        if (speed > 0) {
+            long long behind = wait_until(pool, start + (long long)(rec->ns / 1e3 / speed));
+            if (behind > REPLAY_LATE_US) stats.late++;
+            if (behind > stats.max_behind_us) stats.max_behind_us = behind;
+        }
+        while (free_reqs == NULL && !stopping) {
+            if (client_pool_poll(pool, CLIENT_TIMEOUT_MS) <= 0) stopping = 1;
+        }
+        if (stopping) break;
+
+        // Classes this build does not know count as bulk, as in the server
+        int prio = rec->flags & WIRE_FLAG_PRIO_MASK;
+        if (prio >= WIRE_PRIORITIES) prio = WIRE_PRIO_BULK;
+        if (prio != priority) client_pool_set_priority(pool, priority = prio);
+        int ms = keep_deadlines && rec->timeout_us > 0 ? (int)((rec->timeout_us + 999) / 1000) : 0;
+        if (ms != deadline_ms) client_pool_set_deadline(pool, deadline_ms = ms);
+
+        replay_request *req = free_reqs;
+        free_reqs = req->next_free;
+        req->expected = rec->nums[0] > rec->nums[1] ? rec->nums[0] : rec->nums[1];
+        req->sent_us = monotonic_us();
+        long rc = client_pool_submit(pool, rec->nums[0], rec->nums[1], request_done, req);
+        if (rc < 0) {
+            if (stats.failed++ == 0) stats.first_error = (int)rc;
+            req->next_free = free_reqs;
+            free_reqs = req;
+            continue;
+        }
+        stats.sent++;
+    }
+    int rc = client_pool_drain(pool, CLIENT_TIMEOUT_MS);
+    double secs = (monotonic_us() - start) / 1e6;
+
+    char pace[64] = "full speed";
+    if (speed > 0) snprintf(pace, sizeof(pace), "%gx the recorded pace", speed);
+    printf("Replayed %ld of %zu requests (%.3f s recorded) in %.3f s at %s (%.0f req/s)\n",
+           stats.sent, count, span, secs, pace, secs > 0 ? stats.sent / secs : 0.0);
+    if (speed > 0) {
+        printf("  %ld sent over %d ms behind schedule, at most %.1f ms\n",
+               stats.late, REPLAY_LATE_US / 1000, stats.max_behind_us / 1e3);
+    }
+    printf("  %ld ok, %ld wrong, %ld expired, %ld failed", stats.ok, stats.wrong, stats.expired,
+           stats.failed);
+    if (stats.failed) printf(" (first: %s)", client_strerror(stats.first_error));
+    printf("\n");
+    if (stats.ok > 0) {
+        printf("  latency p50 %.2f ms p99 %.2f ms p99.9 %.2f ms\n", percentile_ms(50),
+               percentile_ms(99), percentile_ms(99.9));
+    }
+    client_pool_report(pool, stdout);
+    if (rc != CLIENT_OK) printf("Drain: %s\n", client_strerror(rc));
+
+    client_pool_destroy(pool);
+    free(reqs);
+    capture_unmap(&trace);
+    return rc == CLIENT_OK && !stopping && stats.sent == (long)count && !stats.wrong && !stats.failed
+           ? EXIT_SUCCESS : EXIT_FAILURE;
+}
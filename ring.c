@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ring.h"
+
+#define SLOT_MASK (RING_SLOTS - 1)
+#define BLOCK_POLL_NS 100000   // Producer re-checks a RING_BLOCK subscriber this often
+
+// stamp is 2*seq+1 while the record of sequence seq is written and 2*seq+2
+// once it can be read, so a reader knows whether the slot holds its record,
+// an older one or a newer one
+typedef struct {
+    _Alignas(64) atomic_ullong stamp;
+    ring_record rec;
+} ring_slot;
+
+enum { SUB_FREE = 0, SUB_ACTIVE = 1 };
+
+typedef struct {
+    _Alignas(64) atomic_ullong cursor;   // Next sequence it reads
+    atomic_int state;
+    atomic_int pid;
+    atomic_int policy;
+    atomic_int demoted;
+    atomic_int sleeping;                 // Counted in sleepers right now
+    atomic_long lost;
+} ring_subscriber;
+
+struct result_ring {
+    _Alignas(64) atomic_ullong head;     // Next sequence to claim
+    _Alignas(64) atomic_int n_active;
+    atomic_int sleepers;                 // Subscribers parked on the futex
+    atomic_uint wake;                    // Futex word, bumped on publish
+    ring_subscriber subs[RING_MAX_SUBSCRIBERS];
+    ring_slot slots[RING_SLOTS];
+};
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Not FUTEX_PRIVATE: the word is shared between processes
+static void futex_wait(atomic_uint *word, unsigned expected, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, (unsigned *)word, FUTEX_WAIT, expected, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+
+static void futex_wake_all(atomic_uint *word) {
+    syscall(SYS_futex, (unsigned *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static result_ring *map_ring(int fd) {
+    void *base = mmap(NULL, sizeof(result_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+result_ring *ring_create(const char *name) {
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd == -1) return NULL;
+    if (ftruncate(fd, sizeof(result_ring)) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    // Fresh pages are zero: no subscriber, every slot older than sequence 0
+    result_ring *r = map_ring(fd);
+    if (r == NULL) shm_unlink(name);
+    return r;
+}
+
+void ring_unlink(const char *name) {
+    shm_unlink(name);
+}
+
+result_ring *ring_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    return fd == -1 ? NULL : map_ring(fd);
+}
+
+void ring_close(result_ring *r) {
+    munmap(r, sizeof(result_ring));
+}
+
+// Wait until every RING_BLOCK subscriber has read past sequence `behind`,
+// demoting the ones that take longer than RING_BLOCK_MS
+static void wait_for_blockers(result_ring *r, unsigned long long behind) {
+    for (int i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        ring_subscriber *s = &r->subs[i];
+        long long since = 0;
+        while (atomic_load(&s->state) == SUB_ACTIVE && atomic_load(&s->policy) == RING_BLOCK &&
+               atomic_load(&s->cursor) <= behind) {
+            if (since == 0) {
+                since = now_ms();
+            } else if (now_ms() - since > RING_BLOCK_MS) {
+                int expected = RING_BLOCK;
+                if (atomic_compare_exchange_strong(&s->policy, &expected, RING_DROP)) {
+                    atomic_store(&s->demoted, 1);
+                }
+                break;
+            }
+            struct timespec ts = { 0, BLOCK_POLL_NS };
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+void ring_publish(result_ring *r, const ring_record *rec) {
+    if (atomic_load_explicit(&r->n_active, memory_order_relaxed) == 0) return;
+
+    unsigned long long seq = atomic_fetch_add_explicit(&r->head, 1, memory_order_relaxed);
+    if (seq >= RING_SLOTS) wait_for_blockers(r, seq - RING_SLOTS);
+
+    ring_slot *slot = &r->slots[seq & SLOT_MASK];
+    atomic_store_explicit(&slot->stamp, 2 * seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->rec = *rec;
+    slot->rec.ns = now_ns();
+    atomic_store_explicit(&slot->stamp, 2 * seq + 2, memory_order_release);
+
+    // Pairs with the fence in ring_next: either the sleeper sees the stamp
+    // or we see the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&r->wake, 1);
+        futex_wake_all(&r->wake);
+    }
+}
+
+int ring_subscribe(result_ring *r, ring_policy policy) {
+    for (int i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        ring_subscriber *s = &r->subs[i];
+        int expected = SUB_FREE;
+        if (!atomic_compare_exchange_strong(&s->state, &expected, SUB_ACTIVE)) continue;
+        atomic_store(&s->pid, (int)getpid());
+        atomic_store(&s->policy, policy);
+        atomic_store(&s->demoted, 0);
+        atomic_store(&s->lost, 0);
+        atomic_store(&s->cursor, atomic_load(&r->head));
+        atomic_fetch_add(&r->n_active, 1);
+        return i;
+    }
+    return -1;
+}
+
+void ring_unsubscribe(result_ring *r, int sub) {
+    ring_subscriber *s = &r->subs[sub];
+    int expected = SUB_ACTIVE;
+    if (atomic_compare_exchange_strong(&s->state, &expected, SUB_FREE)) {
+        atomic_fetch_sub(&r->n_active, 1);
+    }
+}
+
+static void skip(ring_subscriber *s, unsigned long long to, long *lost) {
+    unsigned long long from = atomic_load_explicit(&s->cursor, memory_order_relaxed);
+    atomic_fetch_add(&s->lost, (long)(to - from));
+    if (lost) *lost += (long)(to - from);
+    atomic_store_explicit(&s->cursor, to, memory_order_release);
+}
+
+const ring_record *ring_next(result_ring *r, int sub, int timeout_ms, long *lost) {
+    ring_subscriber *s = &r->subs[sub];
+    long long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    long long stalled_since = 0;
+
+    for (;;) {
+        unsigned long long c = atomic_load_explicit(&s->cursor, memory_order_relaxed);
+        ring_slot *slot = &r->slots[c & SLOT_MASK];
+        unsigned long long stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+        if (stamp == 2 * c + 2) return &slot->rec;
+
+        unsigned long long head = atomic_load(&r->head);
+        if (stamp > 2 * c + 2 || head - c > RING_SLOTS) {
+            // Lapped: go half a ring back from the head, so the producers
+            // do not lap it again right away
+            skip(s, head - RING_SLOTS / 2, lost);
+            stalled_since = 0;
+            continue;
+        }
+        if (head > c) {
+            // Claimed but not stamped yet; a producer that died there
+            // leaves a hole that is skipped eventually
+            if (stalled_since == 0) {
+                stalled_since = now_ms();
+            } else if (now_ms() - stalled_since > RING_STALL_MS) {
+                skip(s, c + 1, lost);
+                stalled_since = 0;
+            }
+            sched_yield();
+            continue;
+        }
+
+        // Nothing new: park until a producer bumps the futex word
+        long long left = deadline < 0 ? -1 : deadline - now_ms();
+        if (deadline >= 0 && left <= 0) return NULL;
+        unsigned wake = atomic_load(&r->wake);
+        atomic_store(&s->sleeping, 1);
+        atomic_fetch_add(&r->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&r->head) == c) futex_wait(&r->wake, wake, (int)left);
+        atomic_fetch_sub(&r->sleepers, 1);
+        atomic_store(&s->sleeping, 0);
+    }
+}
+
+int ring_release(result_ring *r, int sub, long *lost) {
+    ring_subscriber *s = &r->subs[sub];
+    unsigned long long c = atomic_load_explicit(&s->cursor, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    int intact = atomic_load_explicit(&r->slots[c & SLOT_MASK].stamp, memory_order_relaxed) == 2 * c + 2;
+    if (!intact) {
+        atomic_fetch_add(&s->lost, 1);
+        if (lost) (*lost)++;
+    }
+    atomic_store_explicit(&s->cursor, c + 1, memory_order_release);
+    return intact;
+}
+
+int ring_reap(result_ring *r) {
+    int reaped = 0;
+    for (int i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        ring_subscriber *s = &r->subs[i];
+        if (atomic_load(&s->state) != SUB_ACTIVE) continue;
+        if (kill(atomic_load(&s->pid), 0) == -1 && errno == ESRCH) {
+            // Died parked: producers would keep waking nobody
+            if (atomic_exchange(&s->sleeping, 0)) atomic_fetch_sub(&r->sleepers, 1);
+            ring_unsubscribe(r, i);
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+ring_stats ring_get_stats(result_ring *r) {
+    ring_stats st;
+    memset(&st, 0, sizeof(st));
+    st.published = atomic_load(&r->head);
+    for (int i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        ring_subscriber *s = &r->subs[i];
+        if (atomic_load(&s->state) != SUB_ACTIVE) continue;
+        ring_subscriber_stats *out = &st.subs[st.subscribers++];
+        unsigned long long cursor = atomic_load(&s->cursor);
+        out->pid = atomic_load(&s->pid);
+        out->policy = (ring_policy)atomic_load(&s->policy);
+        out->lag = st.published > cursor ? st.published - cursor : 0;
+        out->lost = atomic_load(&s->lost);
+        out->demoted = atomic_load(&s->demoted);
+    }
+    return st;
+}
@@ -0,0 +1,87 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Publish/subscribe stage for the server's results. Each result is
+// written once into a ring in named shared memory (instance.h), and every
+// subscriber, be it a printer, an archiver or a metrics sink, maps the
+// ring and reads the records in place at its own cursor. Producers claim
+// sequence numbers with one fetch-add and stamp a slot once its record is
+// complete, so they never wait for each other; with no subscriber nothing
+// is written at all.
+//
+// A subscriber a whole ring behind gets what its policy says. RING_DROP
+// subscribers are lapped and told how many records they missed. RING_BLOCK
+// subscribers hold the producers back, but for RING_BLOCK_MS at most: then
+// they are demoted to RING_DROP, so a stuck subscriber cannot stall the
+// compare stage.
+
+#define RING_SLOTS 16384           // Records in the ring, power of two
+#define RING_MAX_SUBSCRIBERS 8
+#define RING_BLOCK_MS 50           // Producers wait this long for a RING_BLOCK subscriber
+#define RING_STALL_MS 100          // A slot claimed but unstamped this long is skipped
+
+typedef enum { RING_DROP, RING_BLOCK } ring_policy;
+
+enum {
+    RING_CACHED = 1   // Answered from the result cache, not computed
+};
+
+typedef struct {
+    uint64_t ns;          // CLOCK_MONOTONIC when published
+    int32_t client;
+    uint32_t request_id;
+    int32_t nums[2];
+    int32_t larger;
+    uint32_t flags;
+} ring_record;
+
+typedef struct result_ring result_ring;
+
+typedef struct {
+    int pid;
+    ring_policy policy;
+    unsigned long long lag;   // Records published it has not read yet
+    long lost;
+    int demoted;              // Was RING_BLOCK until it held producers too long
+} ring_subscriber_stats;
+
+typedef struct {
+    unsigned long long published;
+    int subscribers;
+    ring_subscriber_stats subs[RING_MAX_SUBSCRIBERS];
+} ring_stats;
+
+// Daemon: create the ring under name, replacing a stale one, and remove
+// the name again at exit
+result_ring *ring_create(const char *name);
+void ring_unlink(const char *name);
+
+// Producers and subscribers: map an existing ring. NULL on failure.
+result_ring *ring_open(const char *name);
+void ring_close(result_ring *r);
+
+// Producer side; rec->ns is stamped here
+void ring_publish(result_ring *r, const ring_record *rec);
+
+// Register the calling process, reading from the next record published.
+// Returns the subscriber slot, or -1 when all are taken.
+int ring_subscribe(result_ring *r, ring_policy policy);
+void ring_unsubscribe(result_ring *r, int sub);
+
+// The next record, in place, or NULL when none arrived within timeout_ms
+// (-1: no limit). Records skipped since the last call are added to *lost.
+const ring_record *ring_next(result_ring *r, int sub, int timeout_ms, long *lost);
+
+// Done with the record from ring_next. Returns 1 when it stayed intact
+// while it was read, 0 when a producer overwrote it (it counts as lost).
+int ring_release(result_ring *r, int sub, long *lost);
+
+// Daemon: drop subscribers whose process is gone. Returns how many.
+int ring_reap(result_ring *r);
+
+ring_stats ring_get_stats(result_ring *r);
+
+#endif
@@ -0,0 +1,1048 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "daemon.h"
+#include "server.h"
+#include "coro.h"
+#include "ws_deque.h"
+#include "wire.h"
+#include "trace.h"
+#include "fault.h"
+#include "pool_limits.h"
+#include "spawn.h"
+#include "ring.h"
+#include "capture.h"
+
+typedef struct {
+    atomic_long executed;      // Tasks this worker ran
+    atomic_long stolen;        // ...of which were taken from another worker's deque
+    atomic_llong heartbeat;    // monotonic_ms() of the last sign of life
+    atomic_llong ready_ns;     // spawn_now_ns() when it started serving, 0 before
+    atomic_long expired;       // Requests or results dropped past their deadline
+    atomic_long cancelled;     // ...or because their client was gone
+} worker_stats;
+
+// Lives in a memfd mapping created before the workers are started, which
+// they map from the inherited descriptor. Descriptor numbers are the same
+// in every process, so the pipes are found here too.
+typedef struct {
+    ws_deque deques[SERVE_MAX_WORKERS];
+    worker_stats stats[SERVE_MAX_WORKERS + 1];  // The output worker comes last
+    atomic_long dispatched;
+    int n_deques;
+    int doorbells[SERVE_MAX_WORKERS][2];  // Wakes a parked compare worker
+    int answer_bell[2];   // Workers ring it after publishing a result with waiters
+    // Client PID << 32 | low bits of monotonic ms when it was found gone.
+    // Requests it sent before then are dropped; a collision only forgets one.
+    atomic_ullong cancelled[SERVE_CANCEL_SLOTS];
+    result_cache cache;
+} server_shared;
+
+typedef enum { ROLE_COMPARE, ROLE_OUTPUT } worker_role;
+
+typedef struct {
+    pid_t pid;
+    worker_role role;
+    int index;
+    long long started_ns;  // spawn_now_ns() before it was started
+    int reported;          // Its time to ready went into the spawn stats
+} worker;
+
+static worker workers[SERVE_MAX_WORKERS + 1];
+static int n_workers = 0;
+static server_shared *shared = NULL;
+static int shared_fd = -1;
+static result_ring *results = NULL;          // Every result is published here too
+static int self_index = -1;                  // Worker index, -1 in the daemon
+
+// Requests read from FIFO1 wait in the daemon, one queue per priority
+// class, and only SERVE_DEQUE_WINDOW of them sit in each deque. What runs
+// next is thus decided here rather than by arrival order: strict priority,
+// except that a lower class whose head has waited PRIO_AGING_MS takes one
+// dispatch in PRIO_AGED_SHARE, so it slows down under load but never
+// starves. The queues are large enough that FIFO1 keeps being drained and
+// an interactive request never sits in the pipe behind bulk ones.
+typedef struct {
+    serve_request items[PRIO_QUEUE_CAP];
+    long long queued_at[PRIO_QUEUE_CAP];
+    int head;
+    int count;
+    long dispatched;
+    long aged;           // Dispatched ahead of a higher class
+    long long wait_ms;   // Summed over dispatched requests
+} prio_queue;
+
+static prio_queue queues[WIRE_PRIORITIES];
+static int n_queued = 0;
+static int since_aged = 0;   // Dispatches since a lower class last went first
+static int next_deque = 0;
+static wire_reader request_in;   // FIFO1 in the daemon
+static wire_writer answer_out;   // Cache hits and errors, via FIFO2
+static long rejected = 0;
+static long expired_on_arrival = 0;
+static long expired_queued = 0;
+static long cancelled_queued = 0;
+
+// Compare worker: result frames batched onto FIFO2, which all compare
+// workers share, so every writev must stay atomic
+static wire_writer result_out;
+
+// Output worker: one reply FIFO per client, kept open between results
+typedef struct {
+    pid_t client;
+    int fd;               // -1 until the reply FIFO is opened
+    int busy;             // A flush_client coroutine owns the connection
+    long long last_used;
+    wire_writer out;
+} client_conn;
+
+static client_conn *conns[OUTPUT_MAX_CLIENTS];  // Open addressing on the PID
+
+static const char *role_name(worker_role role) {
+    return role == ROLE_COMPARE ? "compare" : "output";
+}
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Push out the batched results, parking while FIFO2 is full. Coroutines
+// that queue more results meanwhile simply join the same drain.
+static void flush_results(void) {
+    trace_mark mark;
+    int frames = result_out.n_frames;
+    trace_begin(&mark, 1);
+    size_t torn = frames > 0 ? fault_partial(sizeof(wire_header)) : 0;
+    if (torn > 0) write(result_out.fd, &result_out.hdrs[0], torn);  // Output worker must resync
+    while (wire_writer_pending(&result_out)) {
+        if (wire_writer_flush(&result_out) == 0) break;
+        if (errno != EAGAIN) {
+            printf("Error writing to FIFO2: %s\n", strerror(errno));
+            wire_writer_reset(&result_out);
+            return;
+        }
+        coro_wait_fd(result_out.fd, POLLOUT, -1);
+    }
+    if (frames > 0) trace_end("emit", &mark, 0, frames);
+}
+
+static void cancel_client(pid_t client) {
+    uint64_t mark = (uint64_t)(uint32_t)client << 32 | (uint32_t)monotonic_ms();
+    atomic_store(&shared->cancelled[(unsigned)client % SERVE_CANCEL_SLOTS], mark);
+}
+
+static int client_cancelled(pid_t client, uint32_t arrived_ms) {
+    uint64_t mark = atomic_load_explicit(&shared->cancelled[(unsigned)client % SERVE_CANCEL_SLOTS],
+                                         memory_order_relaxed);
+    // Wraps after 49 days; the difference of the low bits does not
+    return (uint32_t)(mark >> 32) == (uint32_t)client && (int32_t)((uint32_t)mark - arrived_ms) >= 0;
+}
+
+// 1 when the request is no longer worth any work, counted in st
+static int request_dropped(const serve_request *req, worker_stats *st) {
+    if (wire_expired(req->deadline_ns, wire_now_ns())) {
+        atomic_fetch_add(&st->expired, 1);
+        return 1;
+    }
+    if (client_cancelled(req->client, req->arrived_ms)) {
+        atomic_fetch_add(&st->cancelled, 1);
+        return 1;
+    }
+    return 0;
+}
+
+// Publish a claimed cache entry, dropped requests too: identical requests
+// parked behind it carry deadlines of their own
+static void settle_claim(const serve_request *req, int larger) {
+    if (cache_complete(&shared->cache, &req->ticket, larger)) {
+        char bell = 1;
+        write(shared->answer_bell[1], &bell, 1);  // A full pipe is already rung
+    }
+}
+
+static void publish_result(pid_t client, uint32_t request_id, const int32_t nums[2],
+                           int larger, uint32_t flags) {
+    if (results == NULL) return;
+    ring_record rec = { 0, client, request_id, { nums[0], nums[1] }, larger, flags };
+    ring_publish(results, &rec);
+}
+
+static void compare_request(void *arg) {
+    serve_request *req = arg;
+    worker_stats *st = &shared->stats[self_index];
+    int dropped = request_dropped(req, st);
+    if (!dropped) fault_stage("compare worker");
+    uint64_t start = req->traced_ns && !dropped ? trace_now() : 0;
+    wire_result res;
+    res.larger = (req->nums[0] > req->nums[1]) ? req->nums[0] : req->nums[1];
+    settle_claim(req, res.larger);
+
+    // Checked again: computing may have taken until after the deadline
+    if (dropped || request_dropped(req, st)) {
+        free(req);
+        return;
+    }
+    publish_result(req->client, req->request_id, req->nums, res.larger, 0);
+
+    wire_header hdr;
+    wire_header_init(&hdr, WIRE_OP_RESULT, req->request_id, (uint32_t)req->client,
+                     &res, sizeof(res));
+    hdr.deadline_ns = req->deadline_ns;  // The output worker drops it too if late
+    wire_header_seal(&hdr, &res);
+    if (start) trace_span("compute", start, trace_now(), req->request_id);
+    free(req);
+
+    while (wire_writer_append(&result_out, &hdr, &res) == -1) flush_results();
+}
+
+// Own deque first, then the others in order starting after ours
+static int take_task(ws_task *task) {
+    if (ws_deque_take(&shared->deques[self_index], task) == 0) return 0;
+
+    for (int i = 1; i < shared->n_deques; i++) {
+        int victim = (self_index + i) % shared->n_deques;
+        if (ws_deque_take(&shared->deques[victim], task) == 0) {
+            atomic_fetch_add(&shared->stats[self_index].stolen, 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int tasks_visible(void) {
+    for (int i = 0; i < shared->n_deques; i++) {
+        if (ws_deque_size(&shared->deques[i]) > 0) return 1;
+    }
+    return 0;
+}
+
+// Feed tasks from the deques into per-request coroutines. Only a bounded
+// number are taken at once so that idle workers can steal the rest; the
+// results of each burst leave in one batched write.
+static void task_pump(void *arg) {
+    (void)arg;
+    ws_deque *own = &shared->deques[self_index];
+    int doorbell = shared->doorbells[self_index][0];
+    ws_task task;
+
+    for (;;) {
+        if (coro_count() > WS_MAX_INFLIGHT) {
+            coro_sleep_ms(1);
+            continue;
+        }
+        trace_mark burst;
+        trace_begin(&burst, 1);
+        int taken = 0;
+        while (taken < SERVE_BATCH && take_task(&task) == 0) {
+            if (task.traced_ns) {
+                uint64_t now = trace_now();
+                trace_span("dequeue", task.traced_ns, now, task.request_id);
+                task.traced_ns = now;
+            }
+            ws_task *copy = malloc(sizeof(*copy));
+            if (copy != NULL) {
+                *copy = task;
+                if (coro_spawn(compare_request, copy) == -1) free(copy);
+            }
+            atomic_fetch_add(&shared->stats[self_index].executed, 1);
+            taken++;
+        }
+        if (taken > 0) {
+            coro_yield();  // Let the burst run and queue its results
+            flush_results();
+            trace_end("burst", &burst, 0, taken);
+            continue;
+        }
+        trace_flush();  // Going idle; nothing is lost if we are killed asleep
+
+        // Announce we are going to sleep, then look once more so a push
+        // that raced with the announcement is not missed
+        atomic_store(&own->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!tasks_visible()) {
+            coro_wait_fd(doorbell, POLLIN, WS_IDLE_POLL_MS);
+            char drain[64];
+            while (read(doorbell, drain, sizeof(drain)) > 0) {}
+        }
+        atomic_store(&own->sleeping, 0);
+    }
+}
+
+static int conn_slot(pid_t client) {
+    return (int)((unsigned)client % OUTPUT_MAX_CLIENTS);
+}
+
+static client_conn *conn_find(pid_t client, int create) {
+    for (int i = 0, slot = conn_slot(client); i < OUTPUT_MAX_CLIENTS;
+         i++, slot = (slot + 1) % OUTPUT_MAX_CLIENTS) {
+        if (conns[slot] == NULL) {
+            if (!create) return NULL;
+            client_conn *c = malloc(sizeof(*c));
+            if (c == NULL) return NULL;
+            c->client = client;
+            c->fd = -1;
+            c->busy = 0;
+            c->last_used = monotonic_ms();
+            wire_writer_init(&c->out, -1, 0);
+            conns[slot] = c;
+            return c;
+        }
+        if (conns[slot]->client == client) return conns[slot];
+    }
+    return NULL;
+}
+
+// Remove c and move later members of its probe run back into the gap
+static void conn_release(client_conn *c) {
+    int slot = conn_slot(c->client);
+    while (conns[slot] != c) slot = (slot + 1) % OUTPUT_MAX_CLIENTS;
+    conns[slot] = NULL;
+
+    for (int next = (slot + 1) % OUTPUT_MAX_CLIENTS; conns[next] != NULL;
+         next = (next + 1) % OUTPUT_MAX_CLIENTS) {
+        client_conn *moved = conns[next];
+        conns[next] = NULL;
+        int home = conn_slot(moved->client);
+        while (conns[home] != NULL) home = (home + 1) % OUTPUT_MAX_CLIENTS;
+        conns[home] = moved;
+    }
+
+    if (c->fd != -1) close(c->fd);
+    free(c);
+}
+
+static int open_reply(client_conn *c) {
+    char path[INSTANCE_PATH_MAX];
+    instance_reply_path(&instance, c->client, path, sizeof(path));
+
+    // ENXIO means the client has not opened its reply FIFO for reading yet
+    for (int attempt = 0; attempt < REPLY_OPEN_ATTEMPTS; attempt++) {
+        c->fd = open(path, O_WRONLY | O_NONBLOCK);
+        if (c->fd != -1 || errno != ENXIO) break;
+        coro_sleep_ms(REPLY_OPEN_RETRY_MS);
+    }
+    if (c->fd == -1) return -1;
+    c->out.fd = c->fd;
+    return 0;
+}
+
+// Drain one client's batch; a client that stops reading only parks this
+// coroutine, never the listener or other clients
+static void flush_client(void *arg) {
+    client_conn *c = arg;
+    if (c->fd == -1 && open_reply(c) == -1) {
+        printf("Dropping results for client %d: %s\n", c->client, strerror(errno));
+        cancel_client(c->client);
+        conn_release(c);
+        return;
+    }
+    trace_mark mark;
+    int frames = c->out.n_frames;
+    trace_begin(&mark, 0);
+    while (wire_writer_pending(&c->out)) {
+        if (wire_writer_flush(&c->out) == 0) break;
+        if (errno != EAGAIN) {
+            printf("Client %d went away: %s\n", c->client, strerror(errno));
+            cancel_client(c->client);
+            conn_release(c);
+            return;
+        }
+        coro_wait_fd(c->fd, POLLOUT, -1);
+    }
+    trace_end("emit", &mark, (uint32_t)c->client, frames);
+    c->busy = 0;
+    c->last_used = monotonic_ms();
+}
+
+// Close the least recently used connection with nothing left to send
+static int evict_idle(void) {
+    client_conn *oldest = NULL;
+    for (int i = 0; i < OUTPUT_MAX_CLIENTS; i++) {
+        client_conn *c = conns[i];
+        if (c == NULL || c->busy || wire_writer_pending(&c->out)) continue;
+        if (oldest == NULL || c->last_used < oldest->last_used) oldest = c;
+    }
+    if (oldest == NULL) return -1;
+    conn_release(oldest);
+    return 0;
+}
+
+static void start_flush(client_conn *c) {
+    if (c->busy || !wire_writer_pending(&c->out)) return;
+    c->busy = 1;
+    if (coro_spawn(flush_client, c) == -1) c->busy = 0;  // Next batch retries
+}
+
+// Queue a result frame for its client. If the client's batch is still
+// being drained, or every connection is busy, wait up to CLIENT_TIMEOUT_MS.
+static void route_result(const wire_header *hdr, const void *payload) {
+    if (wire_expired(hdr->deadline_ns, wire_now_ns())) {
+        atomic_fetch_add(&shared->stats[self_index].expired, 1);
+        return;
+    }
+    long long deadline = monotonic_ms() + CLIENT_TIMEOUT_MS;
+    for (int attempt = 0;; attempt++) {
+        client_conn *c = conn_find((pid_t)hdr->client, 1);
+        if (c == NULL && evict_idle() == 0) continue;
+        if (c != NULL) {
+            if (wire_writer_append(&c->out, hdr, payload) == 0) return;
+            start_flush(c);
+        }
+        if (monotonic_ms() > deadline) {
+            printf("Client %u not reading, dropping result %u\n", hdr->client, hdr->request_id);
+            return;
+        }
+        // A full batch usually drains as soon as its flusher gets to run
+        if (attempt == 0) {
+            coro_yield();
+        } else {
+            coro_sleep_ms(1);
+        }
+    }
+}
+
+static void flush_clients(int close_idle) {
+    long long now = monotonic_ms();
+    for (int i = 0; i < OUTPUT_MAX_CLIENTS; i++) {
+        client_conn *c = conns[i];
+        if (c == NULL) continue;
+        start_flush(c);
+        if (close_idle && !c->busy && now - c->last_used >= CLIENT_IDLE_MS) {
+            conn_release(c);
+            i--;  // Another connection may have shifted into this slot
+        }
+    }
+}
+
+static void output_listener(void *arg) {
+    wire_reader *in = arg;
+    wire_header hdr;
+    const void *payload;
+
+    for (;;) {
+        fault_slow();
+        ssize_t n = wire_reader_fill(in);
+        if (n == -1 && errno != EAGAIN) {
+            printf("Error reading FIFO2: %s\n", strerror(errno));
+            break;
+        }
+        if (n <= 0) {
+            flush_clients(0);
+            trace_flush();
+            if (coro_wait_fd(in->fd, POLLIN, CLIENT_IDLE_MS) == 0) flush_clients(1);
+            continue;
+        }
+
+        trace_mark mark;
+        trace_begin(&mark, 1);
+        int rc, routed = 0;
+        while ((rc = wire_reader_peek(in, &hdr, &payload)) != 0) {
+            if (rc == -1) continue;  // Garbage and torn frames are counted in in->skipped
+            route_result(&hdr, payload);
+            routed++;
+            wire_reader_consume(in);
+        }
+        flush_clients(0);
+        trace_end("route", &mark, 0, routed);
+    }
+    coro_stop();
+}
+
+// Runs beside the real work, so it stops beating exactly when the process
+// as a whole stops making progress
+static void heartbeat(void *arg) {
+    atomic_llong *beat = arg;
+    while (!stop_requested) {
+        atomic_store(beat, monotonic_ms());
+        coro_sleep_ms(WORKER_HEARTBEAT_MS);
+    }
+    coro_stop();  // SIGTERM in a profiling build
+}
+
+static void compare_worker(int index) {
+    printf("Compare worker %d started\n", index);
+    fflush(stdout);
+
+    self_index = index;
+    instance_pin(&instance, index);
+    int fd = open(FIFO2, O_WRONLY | O_NONBLOCK);
+    if (fd == -1) {
+        printf("Error opening FIFO2 in compare worker %d\n", index);
+        exit(EXIT_FAILURE);
+    }
+    wire_writer_init(&result_out, fd, 1);
+
+    coro_sched_init(0);
+    coro_spawn(heartbeat, &shared->stats[index].heartbeat);
+    coro_spawn(task_pump, NULL);
+    atomic_store(&shared->stats[index].ready_ns, spawn_now_ns());
+    coro_run();
+    // Only the heartbeat stops the scheduler, on SIGTERM in a profiling
+    // build; anything else ending the pump is a failure
+    exit(stop_requested ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void output_worker(int index) {
+    printf("Output worker started\n");
+    fflush(stdout);
+
+    self_index = index;
+    instance_pin(&instance, index);
+    signal(SIGPIPE, SIG_IGN);  // A vanished client shows up as EPIPE instead
+    int fd = open(FIFO2, O_RDONLY | O_NONBLOCK);
+    wire_reader in;
+    if (fd == -1 || wire_reader_init(&in, fd, SERVE_BATCH * (sizeof(wire_header) + sizeof(wire_result))) == -1) {
+        printf("Error opening FIFO2 in output worker\n");
+        exit(EXIT_FAILURE);
+    }
+
+    coro_sched_init(0);
+    coro_spawn(heartbeat, &shared->stats[index].heartbeat);
+    coro_spawn(output_listener, &in);
+    atomic_store(&shared->stats[index].ready_ns, spawn_now_ns());
+    coro_run();
+    exit(stop_requested ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+int run_server_worker(const char *role, int index, int fd) {
+    shared = mmap(NULL, sizeof(server_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        printf("Error mapping shared memory in %s worker: %s\n", role, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fault_process();
+    if (strcmp(role, role_name(ROLE_COMPARE)) == 0 && index < shared->n_deques) {
+        if ((results = ring_open(instance.ring)) == NULL) {
+            printf("Compare worker %d cannot map %s, not publishing\n", index, instance.ring);
+        }
+        trace_process("compare worker");
+        compare_worker(index);
+    } else if (strcmp(role, role_name(ROLE_OUTPUT)) == 0 && index == shared->n_deques) {
+        trace_process("output worker");
+        output_worker(index);
+    }
+    printf("Unknown server worker %s %d\n", role, index);
+    return EXIT_FAILURE;
+}
+
+// Start the worker in slot w and register it as a persistent child
+static int spawn_worker(worker *w) {
+    sigset_t chld_mask, old_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+
+    atomic_store(&shared->stats[w->index].heartbeat, monotonic_ms());
+    atomic_store(&shared->stats[w->index].ready_ns, 0);
+    w->reported = 0;
+    pid_t pid = start_worker(role_name(w->role), w->index, shared_fd, &w->started_ns);
+    if (pid == -1) {
+        fprintf(stderr, "Cannot start %s worker: %s\n", role_name(w->role), strerror(errno));
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        return -1;
+    }
+
+    w->pid = pid;
+    if (track_child(pid, 1) == -1) {
+        fprintf(stderr, "Child table full, %s worker %d not tracked\n", role_name(w->role), pid);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+static void stop_workers(void) {
+    for (int i = 0; i < n_workers; i++) {
+        if (workers[i].pid > 0 && !child_exited(workers[i].pid)) {
+            kill(workers[i].pid, SIGTERM);
+        }
+    }
+    for (int waited = 0; waited < 5; waited++) {
+        int alive = 0;
+        for (int i = 0; i < n_workers; i++) {
+            if (workers[i].pid > 0 && !child_exited(workers[i].pid)) alive++;
+        }
+        if (alive == 0) return;
+        sleep(1);
+    }
+    for (int i = 0; i < n_workers; i++) {
+        if (workers[i].pid > 0 && !child_exited(workers[i].pid)) {
+            kill(workers[i].pid, SIGKILL);
+        }
+    }
+}
+
+static void ring_doorbell(int index) {
+    char bell = 1;
+    write(shared->doorbells[index][1], &bell, 1);  // A full pipe is already rung
+}
+
+// Wake sleeping owners that have work, and every sleeper when some deque
+// has a backlog worth stealing from
+static void wake_workers(void) {
+    int backlog = 0;
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i < shared->n_deques; i++) {
+        long size = ws_deque_size(&shared->deques[i]);
+        if (size >= WS_STEAL_THRESHOLD) backlog = 1;
+        if (size > 0 && atomic_load(&shared->deques[i].sleeping)) ring_doorbell(i);
+    }
+    if (!backlog) return;
+    for (int i = 0; i < shared->n_deques; i++) {
+        if (atomic_load(&shared->deques[i].sleeping)) ring_doorbell(i);
+    }
+}
+
+// The daemon answers cache hits and bad requests itself, through FIFO2 and
+// the output worker. That worker drains FIFO2 all the time, so waiting for
+// room is brief.
+static void send_answer(const wire_header *hdr, const void *payload) {
+    while (wire_writer_append(&answer_out, hdr, payload) == -1) {
+        if (wire_writer_flush(&answer_out) == 0) continue;
+        if (errno != EAGAIN) {
+            printf("Error writing to FIFO2: %s\n", strerror(errno));
+            wire_writer_reset(&answer_out);
+            continue;
+        }
+        struct pollfd pfd = { .fd = answer_out.fd, .events = POLLOUT, .revents = 0 };
+        poll(&pfd, 1, DISPATCH_RETRY_MS);
+    }
+}
+
+static void answer_error(pid_t client, uint32_t request_id, uint16_t status) {
+    wire_header hdr;
+    wire_header_init(&hdr, WIRE_OP_ERROR, request_id, (uint32_t)client, NULL, 0);
+    hdr.status = status;
+    wire_header_seal(&hdr, NULL);
+    send_answer(&hdr, NULL);
+}
+
+// Answers from the cache, published like the computed ones
+static void answer_result(pid_t client, uint32_t request_id, const int32_t nums[2], int larger) {
+    wire_result res = { larger };
+    wire_header hdr;
+    wire_header_init(&hdr, WIRE_OP_RESULT, request_id, (uint32_t)client, &res, sizeof(res));
+    send_answer(&hdr, &res);
+    publish_result(client, request_id, nums, larger, RING_CACHED);
+}
+
+static void reject_request(const wire_header *req, uint16_t status) {
+    rejected++;
+    answer_error((pid_t)req->client, req->request_id, status);
+}
+
+// Coalesced request whose leader finished (status 0) or was given up on
+static void answer_waiter(void *arg, const cache_waiter *w, int status, int value) {
+    (void)arg;
+    if (status == 0) {
+        answer_result(w->client, w->request_id, w->nums, value);
+    } else {
+        answer_error(w->client, w->request_id, WIRE_STATUS_RETRY);  // Key is gone; client resends
+    }
+}
+
+static int queues_full(void) {
+    for (int p = 0; p < WIRE_PRIORITIES; p++) {
+        if (queues[p].count == PRIO_QUEUE_CAP) return 1;
+    }
+    return 0;
+}
+
+static serve_request *queue_tail(int prio) {
+    prio_queue *q = &queues[prio];
+    return &q->items[(q->head + q->count) & (PRIO_QUEUE_CAP - 1)];
+}
+
+static void queue_commit(int prio) {
+    prio_queue *q = &queues[prio];
+    if (trace_enabled()) queue_tail(prio)->traced_ns = trace_now();
+    q->queued_at[(q->head + q->count) & (PRIO_QUEUE_CAP - 1)] = monotonic_ms();
+    q->count++;
+    n_queued++;
+}
+
+static void queue_pop(int prio) {
+    prio_queue *q = &queues[prio];
+    q->head = (q->head + 1) & (PRIO_QUEUE_CAP - 1);
+    q->count--;
+    n_queued--;
+}
+
+// A request that waited past its deadline, or whose client is gone, is
+// not dispatched. Its cache claim is still settled for the waiters.
+static int drop_queued(const serve_request *req) {
+    if (wire_expired(req->deadline_ns, wire_now_ns())) {
+        expired_queued++;
+    } else if (client_cancelled(req->client, req->arrived_ms)) {
+        cancelled_queued++;
+    } else {
+        return 0;
+    }
+    settle_claim(req, req->nums[0] > req->nums[1] ? req->nums[0] : req->nums[1]);
+    return 1;
+}
+
+// Class to dispatch from next, or -1 when every queue is empty. *aged is
+// set when it jumps ahead of a non-empty higher class.
+static int pick_queue(long long now, int *aged) {
+    int first = -1;
+    for (int p = 0; p < WIRE_PRIORITIES && first == -1; p++) {
+        if (queues[p].count > 0) first = p;
+    }
+    *aged = 0;
+    if (first == -1 || since_aged < PRIO_AGED_SHARE - 1) return first;
+
+    for (int p = WIRE_PRIORITIES - 1; p > first; p--) {
+        prio_queue *q = &queues[p];
+        if (q->count > 0 && now - q->queued_at[q->head] >= PRIO_AGING_MS) {
+            *aged = 1;
+            return p;
+        }
+    }
+    return first;
+}
+
+// Round-robin over the deques that are below the window
+static int push_task(const serve_request *req) {
+    for (int tries = 0; tries < shared->n_deques; tries++) {
+        int target = next_deque;
+        next_deque = (next_deque + 1) % shared->n_deques;
+        if (ws_deque_size(&shared->deques[target]) < SERVE_DEQUE_WINDOW &&
+            ws_deque_push(&shared->deques[target], req) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Answer a request from the cache, park it behind an identical one in
+// flight, or queue it for the workers
+static void admit_request(const wire_header *hdr, const wire_compare *cmp) {
+    int prio = wire_priority(hdr);
+    serve_request *req = queue_tail(prio);
+    req->client = (pid_t)hdr->client;
+    req->request_id = hdr->request_id;
+    req->nums[0] = cmp->nums[0];
+    req->nums[1] = cmp->nums[1];
+    req->traced_ns = 0;
+    req->deadline_ns = hdr->deadline_ns;
+    req->arrived_ms = (uint32_t)monotonic_ms();
+
+    cache_waiter who = { req->client, req->request_id, { req->nums[0], req->nums[1] } };
+    int larger;
+    switch (cache_begin(&shared->cache, req->nums, &who, &larger, &req->ticket)) {
+        case CACHE_HIT:
+            answer_result(req->client, req->request_id, req->nums, larger);
+            break;
+        case CACHE_MISS:
+        case CACHE_BYPASS:
+            queue_commit(prio);
+            break;
+        default:
+            break;  // Parked until the identical request completes
+    }
+}
+
+// Turn frames from FIFO1 into queued requests; cached and coalesced ones
+// never reach the workers
+static void read_requests(void) {
+    wire_header hdr;
+    const void *payload;
+
+    // Hits take no queue slot; bound the pass so the loop stays responsive
+    for (int frames = 0; !queues_full() && frames < 4 * SERVE_BATCH; frames++) {
+        int rc = wire_reader_peek(&request_in, &hdr, &payload);
+        if (rc == 0) {
+            if (wire_reader_fill(&request_in) <= 0) return;
+            continue;
+        }
+        if (rc == -1) continue;  // Garbage and torn frames are counted in request_in.skipped
+
+        if (hdr.opcode != WIRE_OP_COMPARE) {
+            reject_request(&hdr, WIRE_STATUS_BAD_OPCODE);
+        } else if (hdr.length != sizeof(wire_compare)) {
+            reject_request(&hdr, WIRE_STATUS_BAD_LENGTH);
+        } else {
+            uint64_t now = wire_now_ns();
+            wire_compare cmp;
+            memcpy(&cmp, payload, sizeof(cmp));
+            capture_request(&hdr, &cmp, now);
+            if (wire_expired(hdr.deadline_ns, now)) {
+                expired_on_arrival++;  // Sat in FIFO1 too long; not even worth a cache lookup
+            } else {
+                admit_request(&hdr, &cmp);
+            }
+        }
+        wire_reader_consume(&request_in);
+    }
+}
+
+// Move queued requests into the worker deques by priority. Stealing evens
+// out whatever imbalance the round-robin assignment leaves behind.
+static void dispatch_requests(void) {
+    read_requests();
+    if (wire_writer_pending(&answer_out)) wire_writer_flush(&answer_out);
+
+    trace_mark mark;
+    trace_begin(&mark, 1);
+    long long now = monotonic_ms();
+    int sent = 0, aged;
+    for (int prio; (prio = pick_queue(now, &aged)) != -1;) {
+        prio_queue *q = &queues[prio];
+        serve_request *req = &q->items[q->head];
+        if (drop_queued(req)) {
+            queue_pop(prio);
+            continue;
+        }
+        uint64_t queued_ns = req->traced_ns;
+        if (queued_ns) req->traced_ns = trace_now();  // Workers time the deque wait from here
+        if (push_task(req) == -1) {
+            req->traced_ns = queued_ns;
+            break;  // All at the window; retry next pass
+        }
+        if (queued_ns) trace_span("enqueue", queued_ns, req->traced_ns, req->request_id);
+        q->aged += aged;
+        since_aged = aged ? 0 : since_aged + 1;
+        q->wait_ms += now - q->queued_at[q->head];
+        q->dispatched++;
+        queue_pop(prio);
+        sent++;
+    }
+
+    if (sent > 0) {
+        atomic_fetch_add(&shared->dispatched, sent);
+        wake_workers();
+        trace_end("dispatch", &mark, 0, sent);
+    }
+}
+
+static void print_metrics(void) {
+    printf("Dispatched %ld requests, %d waiting for deque space\n",
+           atomic_load(&shared->dispatched), n_queued);
+    static const char *const class_names[WIRE_PRIORITIES] = { "interactive", "bulk" };
+    for (int p = 0; p < WIRE_PRIORITIES; p++) {
+        prio_queue *q = &queues[p];
+        printf("  %s: queued %d dispatched %ld aged %ld mean wait %.2f ms\n", class_names[p],
+               q->count, q->dispatched, q->aged,
+               q->dispatched ? (double)q->wait_ms / q->dispatched : 0.0);
+    }
+    printf("Rejected %ld malformed requests, skipped %ld bytes of garbage\n",
+           rejected, request_in.skipped);
+    printf("Dropped %ld requests expired on arrival, %ld expired and %ld cancelled while queued\n",
+           expired_on_arrival, expired_queued, cancelled_queued);
+    spawn_stats ss = spawn_get_stats();
+    printf("Spawned %ld workers by %s (%ld failed): call mean %.1f us max %.1f us, "
+           "ready mean %.1f us max %.1f us\n", ss.spawned, spawn_method_name(spawn_get_method()),
+           ss.failed, ss.spawned ? ss.call_ns / 1e3 / ss.spawned : 0.0, ss.call_max_ns / 1e3,
+           ss.ready ? ss.ready_ns / 1e3 / ss.ready : 0.0, ss.ready_max_ns / 1e3);
+    ring_stats rs = ring_get_stats(results);
+    printf("Result ring: %llu published, %d subscribers\n", rs.published, rs.subscribers);
+    for (int i = 0; i < rs.subscribers; i++) {
+        const ring_subscriber_stats *sub = &rs.subs[i];
+        printf("  subscriber %d: %s%s, behind %llu, lost %ld\n", sub->pid,
+               sub->policy == RING_BLOCK ? "block" : "drop", sub->demoted ? " (demoted)" : "",
+               sub->lag, sub->lost);
+    }
+    cache_stats cs = cache_get_stats();
+    printf("Cache: %ld hits, %ld misses, %ld coalesced (%d waiting), %ld bypassed, "
+           "%ld evicted, %ld abandoned\n", cs.hits, cs.misses, cs.coalesced, cs.waiting,
+           cs.bypassed, cs.evictions, cs.abandoned);
+    for (int i = 0; i < shared->n_deques; i++) {
+        printf("  worker %d: queued %ld executed %ld stolen %ld expired %ld cancelled %ld\n", i,
+               ws_deque_size(&shared->deques[i]),
+               atomic_load(&shared->stats[i].executed),
+               atomic_load(&shared->stats[i].stolen),
+               atomic_load(&shared->stats[i].expired),
+               atomic_load(&shared->stats[i].cancelled));
+    }
+    printf("  output: %ld results expired\n", atomic_load(&shared->stats[shared->n_deques].expired));
+    capture_report(stdout);
+    limits_report(stdout);
+    fflush(stdout);
+}
+
+// Time from starting each new worker to it serving, once it got there
+static void note_ready_workers(void) {
+    for (int i = 0; i < n_workers; i++) {
+        worker *w = &workers[i];
+        long long ready = atomic_load(&shared->stats[w->index].ready_ns);
+        if (!w->reported && ready != 0) {
+            spawn_note_ready(ready - w->started_ns);
+            w->reported = 1;
+        }
+    }
+}
+
+// Restart workers that died; kill the ones that hang so they are
+// restarted on the next pass. Tasks still in a lost worker's deque are
+// stolen by the others.
+static void supervise_workers(void) {
+    long long now = monotonic_ms();
+    note_ready_workers();
+    int gone = ring_reap(results);
+    if (gone > 0) printf("Dropped %d result subscribers that exited\n", gone);
+    for (int i = 0; i < n_workers && !stop_requested; i++) {
+        worker *w = &workers[i];
+        if (child_exited(w->pid)) {
+            printf("Restarting %s worker (PID %d exited)\n", role_name(w->role), w->pid);
+            spawn_worker(w);
+        } else if (now - atomic_load(&shared->stats[w->index].heartbeat) > WORKER_HANG_MS) {
+            printf("Killing hung %s worker (PID %d)\n", role_name(w->role), w->pid);
+            kill(w->pid, SIGKILL);
+        }
+    }
+}
+
+static int setup_shared(int n_deques) {
+    shared_fd = memfd_create("server_shared", 0);
+    if (shared_fd == -1 || ftruncate(shared_fd, sizeof(server_shared)) == -1) return -1;
+    shared = mmap(NULL, sizeof(server_shared), PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+    if (shared == MAP_FAILED) {
+        shared = NULL;
+        return -1;
+    }
+    for (int i = 0; i < n_deques; i++) {
+        ws_deque_init(&shared->deques[i]);
+        if (pipe(shared->doorbells[i]) == -1) return -1;
+        fcntl(shared->doorbells[i][0], F_SETFL, O_NONBLOCK);
+        fcntl(shared->doorbells[i][1], F_SETFL, O_NONBLOCK);
+    }
+    for (int i = 0; i <= n_deques; i++) {
+        atomic_init(&shared->stats[i].executed, 0);
+        atomic_init(&shared->stats[i].stolen, 0);
+        atomic_init(&shared->stats[i].heartbeat, 0);
+        atomic_init(&shared->stats[i].ready_ns, 0);
+        atomic_init(&shared->stats[i].expired, 0);
+        atomic_init(&shared->stats[i].cancelled, 0);
+    }
+    atomic_init(&shared->dispatched, 0);
+    for (int i = 0; i < SERVE_CANCEL_SLOTS; i++) atomic_init(&shared->cancelled[i], 0);
+    shared->n_deques = n_deques;
+    cache_init(&shared->cache);
+    if (pipe(shared->answer_bell) == -1) return -1;
+    fcntl(shared->answer_bell[0], F_SETFL, O_NONBLOCK);
+    fcntl(shared->answer_bell[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+int run_server(const server_config *cfg) {
+    serving = 1;
+
+    unlink(FIFO1);
+    unlink(FIFO2);
+    if (mkfifo(FIFO1, 0666) == -1 || mkfifo(FIFO2, 0600) == -1) {
+        fprintf(stderr, "mkfifo failed: %s\n", strerror(errno));
+        unlink(FIFO1);
+        return -1;
+    }
+
+    // Hold both ends of both FIFOs: clients and workers can open them in
+    // any order without blocking, and readers never see EOF while the
+    // server runs, even when a worker is being restarted
+    int keep[4];
+    keep[0] = open(FIFO1, O_RDONLY | O_NONBLOCK);
+    keep[1] = open(FIFO1, O_WRONLY | O_NONBLOCK);
+    keep[2] = open(FIFO2, O_RDONLY | O_NONBLOCK);
+    keep[3] = open(FIFO2, O_WRONLY | O_NONBLOCK);
+    if (keep[0] == -1 || keep[1] == -1 || keep[2] == -1 || keep[3] == -1) {
+        fprintf(stderr, "Error opening server FIFOs: %s\n", strerror(errno));
+        unlink(FIFO1);
+        unlink(FIFO2);
+        return -1;
+    }
+
+    if (setup_shared(cfg->workers) == -1 || (results = ring_create(instance.ring)) == NULL ||
+        wire_reader_init(&request_in, keep[0], SERVE_BATCH * (sizeof(wire_header) + sizeof(wire_compare))) == -1) {
+        fprintf(stderr, "Error setting up shared memory: %s\n", strerror(errno));
+        ring_unlink(instance.ring);
+        unlink(FIFO1);
+        unlink(FIFO2);
+        return -1;
+    }
+    wire_writer_init(&answer_out, keep[3], 1);
+    if (cfg->capture && capture_open(cfg->capture) == -1) {
+        fprintf(stderr, "Cannot capture to %s: %s\n", cfg->capture, strerror(errno));
+        ring_unlink(instance.ring);
+        unlink(FIFO1);
+        unlink(FIFO2);
+        return -1;
+    }
+
+    for (int i = 0; i < cfg->workers; i++) {
+        workers[n_workers].role = ROLE_COMPARE;
+        workers[n_workers].index = i;
+        n_workers++;
+    }
+    workers[n_workers].role = ROLE_OUTPUT;
+    workers[n_workers].index = cfg->workers;  // Next CPU after the compare workers
+    n_workers++;
+
+    for (int i = 0; i < n_workers; i++) {
+        if (spawn_worker(&workers[i]) == -1) {
+            stop_workers();
+            capture_close();
+            ring_unlink(instance.ring);
+            unlink(FIFO1);
+            unlink(FIFO2);
+            return -1;
+        }
+    }
+    printf("Server %s started with %d compare workers\n", FIFO1, cfg->workers);
+    fflush(stdout);
+
+    // Dispatch requests, supervise workers once per interval
+    long long last_supervise = monotonic_ms();
+    while (!stop_requested) {
+        struct pollfd pfd[2] = {
+            { .fd = keep[0], .events = POLLIN, .revents = 0 },
+            { .fd = shared->answer_bell[0], .events = POLLIN, .revents = 0 },
+        };
+        int timeout = n_queued > 0 ? DISPATCH_RETRY_MS : SUPERVISE_INTERVAL_MS;
+        poll(pfd, 2, timeout);
+        if (pfd[1].revents & POLLIN) {
+            char drain[64];
+            while (read(shared->answer_bell[0], drain, sizeof(drain)) > 0) {}
+            cache_collect(&shared->cache, answer_waiter, NULL);
+        }
+        if ((pfd[0].revents & POLLIN) || n_queued > 0) {
+            dispatch_requests();
+        }
+        if (wire_writer_pending(&answer_out)) wire_writer_flush(&answer_out);
+
+        long long now = monotonic_ms();
+        if (now - last_supervise >= SUPERVISE_INTERVAL_MS) {
+            supervise_workers();
+            cache_collect(&shared->cache, answer_waiter, NULL);  // Gives up on stale claims
+            trace_flush();
+            last_supervise = now;
+        }
+        if (metrics_requested) {
+            metrics_requested = 0;
+            print_metrics();
+        }
+    }
+
+    stop_workers();
+    trace_flush();
+    capture_report(stdout);
+    capture_close();
+    wire_reader_destroy(&request_in);
+    for (int i = 0; i < 4; i++) close(keep[i]);
+    ring_close(results);
+    ring_unlink(instance.ring);
+    unlink(FIFO1);
+    unlink(FIFO2);
+    printf("Server exiting\n");
+    fflush(stdout);
+    return 0;
+}
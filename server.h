@@ -0,0 +1,70 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "cache.h"
+
+// Server mode: FIFO1 becomes a well-known request FIFO shared by all
+// clients and read only by the daemon, which hands requests to the compare
+// workers through per-worker deques in shared memory. FIFO2 carries results
+// from the compare workers to the output worker, and every client receives
+// its answers on its own reply FIFO. All three speak the framed protocol
+// from wire.h and are named after the daemon instance (instance.h).
+// Every result is also published to the result ring (ring.h), where any
+// number of subscribers can follow the stream without taking from it.
+//
+// A request may carry a deadline (wire.h). The daemon, the compare workers
+// and the output worker each drop it once that has passed, so under
+// overload the capacity goes to requests that can still be answered in
+// time. When the output worker finds a client gone, it marks the client
+// cancelled and the work still queued for it is dropped the same way.
+//
+// With a capture file, every request read from FIFO1 is also recorded
+// there (capture.h) for the replay tool.
+
+#define SERVE_DEFAULT_WORKERS 2
+#define SERVE_MAX_WORKERS 8         // Compare workers; output worker is extra
+#define SERVE_BATCH 64              // Frames taken from a FIFO or deque per wakeup
+#define REPLY_OPEN_RETRY_MS 10      // Client has not opened its reply FIFO yet
+#define REPLY_OPEN_ATTEMPTS 100
+#define CLIENT_TIMEOUT_MS 5000
+#define CLIENT_IDLE_MS 2000         // Reply FIFOs unused this long are closed
+#define OUTPUT_MAX_CLIENTS 256      // Reply FIFOs the output worker keeps open
+#define SUPERVISE_INTERVAL_MS 1000
+#define DISPATCH_RETRY_MS 1         // Deques were full, try again soon
+#define WS_MAX_INFLIGHT 256         // Requests a compare worker holds at once
+#define WS_STEAL_THRESHOLD 2        // Deque depth that wakes idle workers to steal
+#define WS_IDLE_POLL_MS 100         // Idle workers look for work this often anyway
+#define WORKER_HEARTBEAT_MS 250     // Workers show they are alive this often
+#define WORKER_HANG_MS 3000         // A worker silent this long is killed and restarted
+#define SERVE_DEQUE_WINDOW 64       // Tasks queued per deque; the rest wait by priority
+#define PRIO_QUEUE_CAP 65536        // Requests waiting per class, power of two
+#define PRIO_AGING_MS 20            // A lower class waiting this long is aged...
+#define PRIO_AGED_SHARE 4           // ...and gets one dispatch in this many
+#define SERVE_CANCEL_SLOTS 256      // Clients marked gone, hashed on the PID
+
+// A validated COMPARE frame as queued for the compare workers
+typedef struct {
+    pid_t client;         // Reply goes to reply.<client>
+    uint32_t request_id;  // Echoed back in the result frame
+    int nums[2];
+    cache_ticket ticket;  // Cache entry the result is published to
+    uint64_t traced_ns;   // Trace stamp of the last hand-off, 0 when not tracing
+    uint64_t deadline_ns; // From the request frame, 0: none
+    uint32_t arrived_ms;  // Low bits of monotonic ms when read, against cancellations
+} serve_request;
+
+typedef struct {
+    int workers;          // Compare worker processes
+    const char *capture;  // Record every request read into this file (capture.h), NULL: off
+} server_config;
+
+// Run the server inside the daemon until SIGTERM
+int run_server(const server_config *cfg);
+
+// Body of a compare or output worker started by run_server; fd is the
+// shared memory it maps. Returns only on failure.
+int run_server_worker(const char *role, int index, int fd);
+
+#endif
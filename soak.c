@@ -0,0 +1,541 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "client.h"
+#include "instance.h"
+#include "parse_int.h"
+#include "fault.h"
+
+// Chaos and soak harness. Starts a serving daemon under its own instance
+// name with DAEMON_FAULTS set, drives it with client processes (some of
+// which read their replies slowly) and samples throughput, latency, zombie
+// workers and descriptor counts as it goes. After shutdown it checks that
+// nothing was leaked. Exits 0 only when every check passed.
+
+#define SOAK_BUCKETS 640          // Latency histogram, about 6% resolution
+#define SOAK_MAX_CLIENTS 64
+#define SOAK_MAX_PROCS 64         // Daemon processes tracked per sample
+#define SOAK_FD_SLACK 8           // Descriptors the daemon may gain over a run
+#define SOAK_STOP_MS 10000        // Time the daemon gets to shut down
+#define SOAK_SLOW_EVERY_MS 1000   // Slow clients stop reading once this often
+
+typedef struct {
+    atomic_long ok;
+    atomic_long wrong;
+    atomic_long rejected;    // ERROR frames, RETRY included
+    atomic_long errors;      // I/O, protocol and timeouts
+    atomic_long lost;        // Given up on after CLIENT_TIMEOUT_MS of silence
+    atomic_long reconnects;
+    atomic_long hist[SOAK_BUCKETS];
+} client_stats;
+
+typedef struct {
+    const char *daemon;
+    const char *faults;
+    int workers;
+    int clients;
+    int slow_clients;
+    int slow_ms;
+    int depth;
+    int keys;
+    int seconds;
+    int interval;
+    double min_rate;      // Requests per second every interval must reach
+    double max_p99_ms;
+} soak_config;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_stop(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+// Exact below 32 us, then 16 buckets per power of two
+static int bucket_of(long long us) {
+    if (us < 32) return us < 0 ? 0 : (int)us;
+    int exp = 63 - __builtin_clzll((unsigned long long)us);
+    int b = 32 + (exp - 5) * 16 + (int)((us >> (exp - 4)) & 15);
+    return b < SOAK_BUCKETS ? b : SOAK_BUCKETS - 1;
+}
+
+static long long bucket_top(int b) {
+    if (b < 32) return b;
+    int exp = 5 + (b - 32) / 16;
+    return ((16LL + (b - 32) % 16 + 1) << (exp - 4)) - 1;
+}
+
+// ---- client processes ----
+
+typedef struct soak_request {
+    client_stats *stats;
+    long long sent_us;
+    int expected;
+    struct soak_request *next_free;
+} soak_request;
+
+static soak_request *free_reqs;
+static int abandoning = 0;   // Outstanding requests are being written off as lost
+
+static void request_done(void *arg, int status, int larger) {
+    soak_request *req = arg;
+    client_stats *st = req->stats;
+    if (status == CLIENT_OK) {
+        atomic_fetch_add_explicit(larger == req->expected ? &st->ok : &st->wrong, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->hist[bucket_of(monotonic_us() - req->sent_us)], 1,
+                                  memory_order_relaxed);
+    } else if (status == CLIENT_ERR_REJECTED) {
+        atomic_fetch_add_explicit(&st->rejected, 1, memory_order_relaxed);
+    } else if (stop || abandoning) {
+        // Cut off by our own shutdown or already counted as lost
+    } else {
+        atomic_fetch_add_explicit(&st->errors, 1, memory_order_relaxed);
+    }
+    req->next_free = free_reqs;
+    free_reqs = req;
+}
+
+static client *connect_retry(const char *name) {
+    for (int attempt = 0; attempt < 100 && !stop; attempt++) {
+        client *c = client_connect_to(name);
+        if (c) return c;
+        sleep_ms(50);
+    }
+    return NULL;
+}
+
+static void run_client(const soak_config *cfg, const char *name, client_stats *st, int index, int slow) {
+    signal(SIGTERM, on_stop);
+    signal(SIGPIPE, SIG_IGN);
+    soak_request *reqs = calloc((size_t)cfg->depth, sizeof(*reqs));
+    if (reqs == NULL) _exit(EXIT_FAILURE);
+    for (int i = 0; i < cfg->depth; i++) {
+        reqs[i].stats = st;
+        reqs[i].next_free = i + 1 < cfg->depth ? &reqs[i + 1] : NULL;
+    }
+    free_reqs = reqs;
+
+    client *c = connect_retry(name);
+    long long last_progress = monotonic_us(), last_pause = last_progress;
+    long seq = 0;
+    while (!stop && c != NULL) {
+        while (free_reqs != NULL) {
+            soak_request *req = free_reqs;
+            free_reqs = req->next_free;
+            int a = (int)(seq++ % cfg->keys) + index * cfg->keys;
+            int b = cfg->keys / 2;
+            req->expected = a > b ? a : b;
+            req->sent_us = monotonic_us();
+            if (client_submit(c, a, b, request_done, req) < 0) {
+                req->next_free = free_reqs;
+                free_reqs = req;
+                break;
+            }
+        }
+
+        int rc = client_poll(c, 100);
+        long long now = monotonic_us();
+        if (rc > 0) last_progress = now;
+        if (rc < 0 || now - last_progress > CLIENT_TIMEOUT_MS * 1000LL) {
+            // Replies that never come (a worker crashed holding them) or a
+            // broken FIFO: start over on a fresh connection
+            atomic_fetch_add(&st->lost, client_inflight(c));
+            atomic_fetch_add(&st->reconnects, 1);
+            abandoning = 1;
+            client_close(c);
+            abandoning = 0;
+            c = connect_retry(name);
+            last_progress = monotonic_us();
+        }
+        if (slow && now - last_pause > SOAK_SLOW_EVERY_MS * 1000LL) {
+            sleep_ms(cfg->slow_ms);  // Replies pile up in our FIFO meanwhile
+            last_pause = monotonic_us();
+        }
+    }
+    if (c) {
+        client_drain(c, CLIENT_TIMEOUT_MS);
+        client_close(c);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+// ---- daemon observation ----
+
+static int read_cmdline(pid_t pid, char *buf, size_t len) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    size_t n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    for (size_t i = 0; i < n; i++) {
+        if (buf[i] == '\0') buf[i] = ' ';
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+// State letter and parent of pid, from /proc/<pid>/stat
+static int read_stat(pid_t pid, char *state, pid_t *ppid) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');  // The command name may contain spaces
+    int parent;
+    if (p == NULL || sscanf(p + 1, " %c %d", state, &parent) != 2) return -1;
+    *ppid = parent;
+    return 0;
+}
+
+static int count_fds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return -1;
+    int n = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.') n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+typedef struct {
+    pid_t pids[SOAK_MAX_PROCS];
+    int n;
+    pid_t zombies[SOAK_MAX_PROCS];
+    int n_zombies;
+    int worker_fds;            // Highest descriptor count among the workers
+} proc_sample;
+
+// Processes whose command line carries our instance name; the daemon is
+// the one whose parent is not among them. Zombies have no command line
+// left, so they are found as dead children of those processes.
+static pid_t sample_procs(const char *tag, proc_sample *s) {
+    memset(s, 0, sizeof(*s));
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) return -1;
+    pid_t parents[SOAK_MAX_PROCS], dead[SOAK_MAX_PROCS], dead_parents[SOAK_MAX_PROCS];
+    int n_dead = 0;
+    struct dirent *ent;
+    char cmd[512], state;
+    pid_t ppid;
+    while ((ent = readdir(dir)) != NULL) {
+        pid_t pid = (pid_t)atoi(ent->d_name);
+        if (pid <= 0 || pid == getpid() || read_stat(pid, &state, &ppid) == -1) continue;
+        if (state == 'Z') {
+            if (n_dead < SOAK_MAX_PROCS) {
+                dead[n_dead] = pid;
+                dead_parents[n_dead++] = ppid;
+            }
+        } else if (s->n < SOAK_MAX_PROCS && read_cmdline(pid, cmd, sizeof(cmd)) == 0 &&
+                   strstr(cmd, tag) != NULL) {
+            parents[s->n] = ppid;
+            s->pids[s->n++] = pid;
+        }
+    }
+    closedir(dir);
+
+    pid_t daemon = -1;
+    for (int i = 0; i < s->n; i++) {
+        int child = 0;
+        for (int j = 0; j < s->n && !child; j++) child = parents[i] == s->pids[j];
+        if (!child) daemon = s->pids[i];
+    }
+    for (int i = 0; i < s->n; i++) {
+        if (s->pids[i] == daemon) continue;
+        int fds = count_fds(s->pids[i]);
+        if (fds > s->worker_fds) s->worker_fds = fds;
+    }
+    for (int i = 0; i < n_dead; i++) {
+        for (int j = 0; j < s->n; j++) {
+            if (dead_parents[i] == s->pids[j]) {
+                s->zombies[s->n_zombies++] = dead[i];
+                break;
+            }
+        }
+    }
+    return daemon;
+}
+
+// Zombies present in both samples: reaped late or never
+static int stuck_zombies(const proc_sample *prev, const proc_sample *now) {
+    int stuck = 0;
+    for (int i = 0; i < now->n_zombies; i++) {
+        for (int j = 0; j < prev->n_zombies; j++) stuck += now->zombies[i] == prev->zombies[j];
+    }
+    return stuck;
+}
+
+static int count_entries(const char *dir_path, const char *prefix) {
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) return 0;
+    int n = 0;
+    struct dirent *ent;
+    size_t len = strlen(prefix);
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.' && strncmp(ent->d_name, prefix, len) == 0) n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// ---- aggregation ----
+
+typedef struct {
+    long ok, wrong, rejected, errors, lost, reconnects;
+    long hist[SOAK_BUCKETS];
+} totals;
+
+static void collect(client_stats *stats, int n, totals *t) {
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < n; i++) {
+        t->ok += atomic_load(&stats[i].ok);
+        t->wrong += atomic_load(&stats[i].wrong);
+        t->rejected += atomic_load(&stats[i].rejected);
+        t->errors += atomic_load(&stats[i].errors);
+        t->lost += atomic_load(&stats[i].lost);
+        t->reconnects += atomic_load(&stats[i].reconnects);
+        for (int b = 0; b < SOAK_BUCKETS; b++) t->hist[b] += atomic_load(&stats[i].hist[b]);
+    }
+}
+
+// Percentile of the completions between two snapshots, in milliseconds
+static double percentile_ms(const totals *now, const totals *before, double pct) {
+    long total = 0;
+    for (int b = 0; b < SOAK_BUCKETS; b++) total += now->hist[b] - (before ? before->hist[b] : 0);
+    if (total == 0) return 0.0;
+    long rank = (long)(pct / 100.0 * (double)total), seen = 0;
+    for (int b = 0; b < SOAK_BUCKETS; b++) {
+        seen += now->hist[b] - (before ? before->hist[b] : 0);
+        if (seen > rank) return bucket_top(b) / 1000.0;
+    }
+    return bucket_top(SOAK_BUCKETS - 1) / 1000.0;
+}
+
+static int check(const char *what, int ok, const char *detail) {
+    printf("%s %-28s %s\n", ok ? "PASS" : "FAIL", what, detail);
+    return ok;
+}
+
+// ---- main ----
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -x path    daemon binary (default ./daemon)\n");
+    fprintf(stderr, "  -F spec    faults for the daemon, as in %s\n", FAULT_ENV);
+    fprintf(stderr, "  -w n       compare workers (default %d)\n", SERVE_DEFAULT_WORKERS);
+    fprintf(stderr, "  -c n       client processes (default 4)\n");
+    fprintf(stderr, "  -l n       of which slow readers (default 1)\n");
+    fprintf(stderr, "  -L ms      slow readers stop reading this long each second (default 200)\n");
+    fprintf(stderr, "  -d n       requests in flight per client (default 256)\n");
+    fprintf(stderr, "  -k n       distinct keys per client (default 100000)\n");
+    fprintf(stderr, "  -t s       run time in seconds (default 60)\n");
+    fprintf(stderr, "  -r s       report interval in seconds (default 5)\n");
+    fprintf(stderr, "  -T req/s   minimum throughput of every interval (default 0)\n");
+    fprintf(stderr, "  -P ms      maximum p99 latency of every interval (default 1000)\n");
+}
+
+static int parse_arg(const char *prog, const char *arg, int min) {
+    int value;
+    if (parse_int_arg(arg, &value) != PARSE_OK || value < min) {
+        usage(prog);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    soak_config cfg = { "./daemon", "", SERVE_DEFAULT_WORKERS, 4, 1, 200, 256, 100000,
+                        60, 5, 0.0, 1000.0 };
+    int opt;
+    while ((opt = getopt(argc, argv, "x:F:w:c:l:L:d:k:t:r:T:P:")) != -1) {
+        switch (opt) {
+            case 'x': cfg.daemon = optarg; break;
+            case 'F': cfg.faults = optarg; break;
+            case 'w': cfg.workers = parse_arg(argv[0], optarg, 1); break;
+            case 'c': cfg.clients = parse_arg(argv[0], optarg, 1); break;
+            case 'l': cfg.slow_clients = parse_arg(argv[0], optarg, 0); break;
+            case 'L': cfg.slow_ms = parse_arg(argv[0], optarg, 0); break;
+            case 'd': cfg.depth = parse_arg(argv[0], optarg, 1); break;
+            case 'k': cfg.keys = parse_arg(argv[0], optarg, 1); break;
+            case 't': cfg.seconds = parse_arg(argv[0], optarg, 1); break;
+            case 'r': cfg.interval = parse_arg(argv[0], optarg, 1); break;
+            case 'T': cfg.min_rate = parse_arg(argv[0], optarg, 0); break;
+            case 'P': cfg.max_p99_ms = parse_arg(argv[0], optarg, 1); break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc || cfg.clients > SOAK_MAX_CLIENTS || cfg.slow_clients > cfg.clients ||
+        cfg.depth > CLIENT_MAX_INFLIGHT || fault_init(cfg.faults) == -1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    char name[INSTANCE_NAME_MAX], reply_prefix[INSTANCE_PATH_MAX];
+    daemon_instance inst;
+    snprintf(name, sizeof(name), "soak%d", (int)getpid());
+    instance_init(&inst, name);
+    snprintf(reply_prefix, sizeof(reply_prefix), "reply.%s.", name);
+    int shm_before = count_entries("/dev/shm", "");
+
+    // The daemon detaches by itself; the process we start exits at once
+    char workers[16];
+    snprintf(workers, sizeof(workers), "%d", cfg.workers);
+    setenv(FAULT_ENV, cfg.faults, 1);
+    pid_t starter = fork();
+    if (starter == 0) {
+        execl(cfg.daemon, cfg.daemon, "-s", "-w", workers, "-i", name, (char *)NULL);
+        fprintf(stderr, "Cannot run %s: %s\n", cfg.daemon, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    waitpid(starter, &status, 0);
+    unsetenv(FAULT_ENV);
+
+    struct stat st;
+    for (int waited = 0; stat(inst.fifo1, &st) == -1; waited += 50) {
+        if (waited > 5000) {
+            fprintf(stderr, "Daemon did not create %s\n", inst.fifo1);
+            exit(EXIT_FAILURE);
+        }
+        sleep_ms(50);
+    }
+    proc_sample prev, sample;
+    pid_t daemon = sample_procs(name, &prev);
+    if (daemon == -1) {
+        fprintf(stderr, "Cannot find the daemon process\n");
+        exit(EXIT_FAILURE);
+    }
+    int fds_start = count_fds(daemon);
+    printf("Soak: daemon %d (%s), %d workers, %d clients (%d slow), depth %d, %d s, faults '%s'\n",
+           (int)daemon, name, cfg.workers, cfg.clients, cfg.slow_clients, cfg.depth,
+           cfg.seconds, cfg.faults);
+
+    client_stats *stats = mmap(NULL, (size_t)cfg.clients * sizeof(client_stats),
+                               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) exit(EXIT_FAILURE);
+    pid_t clients[SOAK_MAX_CLIENTS];
+    for (int i = 0; i < cfg.clients; i++) {
+        clients[i] = fork();
+        if (clients[i] == 0) run_client(&cfg, name, &stats[i], i, i < cfg.slow_clients);
+    }
+
+    totals before, now;
+    collect(stats, cfg.clients, &before);
+    int ok = 1, worst_zombies = 0, worst_worker_fds = 0;
+    double worst_rate = -1.0, worst_p99 = 0.0;
+    long long start = monotonic_us(), last = start;
+    while (monotonic_us() - start < cfg.seconds * 1000000LL) {
+        sleep_ms(cfg.interval * 1000);
+        long long t = monotonic_us();
+        collect(stats, cfg.clients, &now);
+        double rate = (now.ok - before.ok) / ((t - last) / 1e6);
+        double p50 = percentile_ms(&now, &before, 50), p99 = percentile_ms(&now, &before, 99);
+        pid_t d = sample_procs(name, &sample);
+        int stuck = stuck_zombies(&prev, &sample);
+        int fds = d == -1 ? -1 : count_fds(d);
+
+        printf("[%5.0f s] %8.0f req/s  p50 %7.2f ms  p99 %7.2f ms  procs %d  zombies %d (stuck %d)  "
+               "fds %d/%d  lost %ld  reconnects %ld\n",
+               (t - start) / 1e6, rate, p50, p99, sample.n, sample.n_zombies, stuck, fds,
+               sample.worker_fds, now.lost, now.reconnects);
+        if (worst_rate < 0 || rate < worst_rate) worst_rate = rate;
+        if (p99 > worst_p99) worst_p99 = p99;
+        if (stuck > worst_zombies) worst_zombies = stuck;
+        if (sample.worker_fds > worst_worker_fds) worst_worker_fds = sample.worker_fds;
+        if (d != daemon) {
+            printf("Daemon %d is gone\n", (int)daemon);
+            ok = 0;
+            break;
+        }
+        before = now;
+        prev = sample;
+        last = t;
+    }
+    long long elapsed = monotonic_us() - start;
+    int fds_end = count_fds(daemon);
+
+    for (int i = 0; i < cfg.clients; i++) kill(clients[i], SIGTERM);
+    for (int i = 0; i < cfg.clients; i++) waitpid(clients[i], &status, 0);
+    collect(stats, cfg.clients, &now);
+
+    kill(daemon, SIGTERM);
+    int alive = 1;
+    for (int waited = 0; waited < SOAK_STOP_MS && alive; waited += 50) {
+        sleep_ms(50);
+        alive = sample_procs(name, &sample) != -1 || sample.n > 0;
+    }
+
+    char detail[160];
+    printf("\nCompleted %ld requests in %.1f s (%.0f req/s), p50 %.2f ms p99 %.2f ms p99.9 %.2f ms\n",
+           now.ok, elapsed / 1e6, now.ok / (elapsed / 1e6), percentile_ms(&now, NULL, 50),
+           percentile_ms(&now, NULL, 99), percentile_ms(&now, NULL, 99.9));
+    printf("Rejected %ld, errors %ld, lost %ld, reconnects %ld\n",
+           now.rejected, now.errors, now.lost, now.reconnects);
+
+    snprintf(detail, sizeof(detail), "%ld wrong answers", now.wrong);
+    ok &= check("answers", now.wrong == 0, detail);
+    // Only a worker that crashes or hangs takes requests down with it;
+    // every other fault must leave each request answered
+    int may_lose = fault_configured(FAULT_CRASH) || fault_configured(FAULT_HANG);
+    snprintf(detail, sizeof(detail), "%ld lost, %ld reconnects%s", now.lost, now.reconnects,
+             may_lose ? " (crash/hang faults on)" : "");
+    ok &= check("lost requests", may_lose || (now.lost == 0 && now.reconnects == 0), detail);
+    snprintf(detail, sizeof(detail), "%ld I/O, protocol or timeout failures%s", now.errors,
+             may_lose ? " (crash/hang faults on)" : "");
+    ok &= check("errors", may_lose || now.errors == 0, detail);
+    snprintf(detail, sizeof(detail), "worst interval %.0f req/s, required %.0f", worst_rate, cfg.min_rate);
+    ok &= check("throughput", worst_rate >= cfg.min_rate, detail);
+    snprintf(detail, sizeof(detail), "worst interval %.2f ms, allowed %.0f", worst_p99, cfg.max_p99_ms);
+    ok &= check("p99 latency", worst_p99 <= cfg.max_p99_ms, detail);
+    snprintf(detail, sizeof(detail), "%d left unreaped across a sample", worst_zombies);
+    ok &= check("zombies", worst_zombies == 0, detail);
+    snprintf(detail, sizeof(detail), "daemon %d -> %d, workers at most %d", fds_start, fds_end,
+             worst_worker_fds);
+    ok &= check("descriptors", fds_end <= fds_start + SOAK_FD_SLACK &&
+                               worst_worker_fds <= cfg.clients + SERVE_MAX_WORKERS + 32, detail);
+    snprintf(detail, sizeof(detail), "%s", alive ? "still running" : "exited");
+    ok &= check("shutdown", !alive, detail);
+    int fifos = (stat(inst.fifo1, &st) == 0) + (stat(inst.fifo2, &st) == 0) +
+                count_entries(".", reply_prefix);
+    snprintf(detail, sizeof(detail), "%d left behind", fifos);
+    ok &= check("FIFOs", fifos == 0, detail);
+    int shm_after = count_entries("/dev/shm", "");
+    snprintf(detail, sizeof(detail), "/dev/shm %d -> %d entries", shm_before, shm_after);
+    ok &= check("shared memory", shm_after <= shm_before, detail);
+
+    printf("%s (daemon log in %s)\n", ok ? "SOAK PASSED" : "SOAK FAILED", inst.log);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include "spawn.h"
+
+// The running binary, even when the file was replaced or removed since
+#define SELF_EXE "/proc/self/exe"
+
+static spawn_method method = SPAWN_EXEC;
+static const char *self_name = "daemon";
+static spawn_entry worker_entry = NULL;
+static spawn_stats stats;
+
+void spawn_init(spawn_method m, const char *argv0, spawn_entry entry) {
+    method = m;
+    self_name = argv0;
+    worker_entry = entry;
+}
+
+spawn_method spawn_get_method(void) {
+    return method;
+}
+
+const char *spawn_method_name(spawn_method m) {
+    return m == SPAWN_FORK ? "fork" : "exec";
+}
+
+int spawn_parse_method(const char *name, spawn_method *m) {
+    if (strcmp(name, "exec") == 0) {
+        *m = SPAWN_EXEC;
+    } else if (strcmp(name, "fork") == 0) {
+        *m = SPAWN_FORK;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int spawn_is_worker(int argc, char *argv[]) {
+    return argc >= 3 && strcmp(argv[1], SPAWN_WORKER_ARG) == 0;
+}
+
+long long spawn_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static pid_t exec_worker(char *const argv[]) {
+    posix_spawnattr_t attr;
+    sigset_t none, all;
+    sigemptyset(&none);
+    sigfillset(&all);
+
+    int rc = posix_spawnattr_init(&attr);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    // Ignored signals would stay ignored across exec
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    rc = posix_spawn(&pid, SELF_EXE, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t fork_worker(int argc, char *argv[]) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Start out like an exec'd worker would
+    for (int sig = 1; sig < NSIG; sig++) signal(sig, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    exit(worker_entry(argc - 2, argv + 2));
+}
+
+pid_t spawn_process(char *const args[], long long *started_ns) {
+    char *argv[SPAWN_MAX_ARGS + 3];
+    int argc = 0;
+    argv[argc++] = (char *)self_name;
+    argv[argc++] = SPAWN_WORKER_ARG;
+    for (int i = 0; args[i] != NULL; i++) {
+        if (i == SPAWN_MAX_ARGS) {
+            errno = E2BIG;
+            return -1;
+        }
+        argv[argc++] = args[i];
+    }
+    argv[argc] = NULL;
+
+    fflush(NULL);  // A forked child would flush our buffered output again
+    long long start = spawn_now_ns();
+    if (started_ns) *started_ns = start;
+    pid_t pid = method == SPAWN_FORK ? fork_worker(argc, argv) : exec_worker(argv);
+    long long took = spawn_now_ns() - start;
+
+    if (pid == -1) {
+        stats.failed++;
+        return -1;
+    }
+    stats.spawned++;
+    stats.call_ns += took;
+    if (took > stats.call_max_ns) stats.call_max_ns = took;
+    return pid;
+}
+
+void spawn_note_ready(long long ready_ns) {
+    stats.ready++;
+    stats.ready_ns += ready_ns;
+    if (ready_ns > stats.ready_max_ns) stats.ready_max_ns = ready_ns;
+}
+
+spawn_stats spawn_get_stats(void) {
+    return stats;
+}
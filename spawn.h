@@ -0,0 +1,65 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+
+// Starting worker processes. fork() copies the page tables of the whole
+// daemon, which grow with its priority queues, result cache and reduce
+// input, and the copy-on-write faults that follow hit both sides. By
+// default the daemon instead re-executes its own binary with posix_spawn,
+// which glibc runs on clone(CLONE_VM | CLONE_VFORK): no page tables are
+// copied and the daemon is suspended only until the exec. A worker started
+// that way finds its shared state through the descriptors it inherits, so
+// everything it needs is named on its command line:
+//
+//   daemon --worker <role> <args...>
+//
+// With fork the child runs the same entry with the same arguments, which
+// keeps both methods on one code path and makes them comparable (-p).
+
+#define SPAWN_WORKER_ARG "--worker"
+#define SPAWN_MAX_ARGS 16
+
+typedef enum { SPAWN_EXEC, SPAWN_FORK } spawn_method;
+
+typedef struct {
+    long spawned;
+    long failed;
+    long long call_ns;       // Summed time inside posix_spawn() or fork()
+    long long call_max_ns;
+    long ready;              // Workers that reported in
+    long long ready_ns;      // Summed time from the call to the worker's report
+    long long ready_max_ns;
+} spawn_stats;
+
+// Run by the worker with the arguments that follow "--worker"; its return
+// value is the exit status of the process
+typedef int (*spawn_entry)(int argc, char *argv[]);
+
+// Before the first spawn. argv0 is shown by ps for the workers too.
+void spawn_init(spawn_method method, const char *argv0, spawn_entry entry);
+
+spawn_method spawn_get_method(void);
+const char *spawn_method_name(spawn_method method);
+
+// "exec" or "fork". Returns 0, or -1 for an unknown name.
+int spawn_parse_method(const char *name, spawn_method *method);
+
+// 1 when this process was started as a worker (argv[1] is "--worker")
+int spawn_is_worker(int argc, char *argv[]);
+
+// Start a worker with the NULL-terminated args, the first being its role.
+// The worker starts with no signal blocked and every handler at default.
+// Returns its PID, or -1 with errno set. *started_ns, when given, receives
+// spawn_now_ns() from just before the call.
+pid_t spawn_process(char *const args[], long long *started_ns);
+
+// Account a worker that reported in ready_ns after it was started
+void spawn_note_ready(long long ready_ns);
+
+spawn_stats spawn_get_stats(void);
+
+// CLOCK_MONOTONIC in nanoseconds, comparable across processes
+long long spawn_now_ns(void);
+
+#endif
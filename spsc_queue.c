@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "spsc_queue.h"
+
+#define SPIN_BEFORE_YIELD 128
+
+int spsc_queue_init(spsc_queue *q, size_t capacity, size_t elem_size) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    q->buf = malloc(cap * elem_size);
+    if (q->buf == NULL) return -1;
+
+    q->mask = cap - 1;
+    q->elem_size = elem_size;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    return 0;
+}
+
+void spsc_queue_destroy(spsc_queue *q) {
+    free(q->buf);
+    q->buf = NULL;
+}
+
+int spsc_queue_try_push(spsc_queue *q, const void *elem) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head > q->mask) return -1;  // Full
+
+    memcpy(q->buf + (tail & q->mask) * q->elem_size, elem, q->elem_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int spsc_queue_try_pop(spsc_queue *q, void *elem) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return -1;  // Empty
+
+    memcpy(elem, q->buf + (head & q->mask) * q->elem_size, q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+void spsc_queue_push(spsc_queue *q, const void *elem) {
+    for (int spins = 0; spsc_queue_try_push(q, elem) == -1; spins++) {
+        if (spins >= SPIN_BEFORE_YIELD) sched_yield();
+    }
+}
+
+int spsc_queue_pop(spsc_queue *q, void *elem) {
+    for (int spins = 0; ; spins++) {
+        if (spsc_queue_try_pop(q, elem) == 0) return 0;
+        if (atomic_load_explicit(&q->closed, memory_order_acquire)) {
+            // Close happens after the last push, so one more look is enough
+            return spsc_queue_try_pop(q, elem);
+        }
+        if (spins >= SPIN_BEFORE_YIELD) sched_yield();
+    }
+}
+
+void spsc_queue_close(spsc_queue *q) {
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+}
@@ -0,0 +1,37 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SPSC_CACHE_LINE 64
+
+// Bounded single-producer/single-consumer ring of fixed-size records.
+// Head and tail live on separate cache lines so the two stages never
+// bounce the same line on every hop.
+typedef struct {
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;  // Next slot to pop (consumer)
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;  // Next slot to push (producer)
+    _Alignas(SPSC_CACHE_LINE) atomic_int closed;   // Producer is done
+    size_t mask;
+    size_t elem_size;
+    unsigned char *buf;
+} spsc_queue;
+
+// Capacity is rounded up to a power of two. Returns 0 or -1 on ENOMEM.
+int spsc_queue_init(spsc_queue *q, size_t capacity, size_t elem_size);
+void spsc_queue_destroy(spsc_queue *q);
+
+// Non-blocking operations, return 0 on success and -1 when full/empty
+int spsc_queue_try_push(spsc_queue *q, const void *elem);
+int spsc_queue_try_pop(spsc_queue *q, void *elem);
+
+// Spin (then yield) until there is room / data. Pop returns -1 once the
+// queue is closed and drained.
+void spsc_queue_push(spsc_queue *q, const void *elem);
+int spsc_queue_pop(spsc_queue *q, void *elem);
+
+// Mark end of stream; the consumer sees it after draining queued records
+void spsc_queue_close(spsc_queue *q);
+
+#endif
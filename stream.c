@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "daemon.h"
+#include "stream.h"
+#include "parse_int.h"
+#include "trace.h"
+#include "fault.h"
+#include "pool_limits.h"
+
+// Lives in a memfd mapping the workers map from the inherited descriptor
+typedef struct {
+    stream_config cfg;
+    atomic_long values;      // Parsed from FIFO1
+    atomic_long malformed;   // Tokens that were not an int32
+    atomic_long reports;     // Sent over FIFO2
+    atomic_long dropped;     // Not sent: FIFO2 was full or memory ran out
+} stream_shared;
+
+enum { STREAM_WINDOW, STREAM_REPORT, STREAM_WORKERS };
+
+static const char *const role_names[STREAM_WORKERS] = { "window", "report" };
+static pid_t workers[STREAM_WORKERS];
+static stream_shared *shared = NULL;
+static int shared_fd = -1;
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int stream_parse_window(const char *spec, stream_config *cfg) {
+    char digits[16];
+    size_t len = strlen(spec);
+    uint64_t unit = 0;
+    if (len > 2 && strcmp(spec + len - 2, "ms") == 0) {
+        unit = 1000000ull;
+        len -= 2;
+    } else if (len > 1 && spec[len - 1] == 's') {
+        unit = 1000000000ull;
+        len -= 1;
+    }
+    if (len == 0 || len >= sizeof(digits)) return -1;
+    memcpy(digits, spec, len);
+    digits[len] = '\0';
+
+    int n;
+    if (parse_int_arg(digits, &n) != PARSE_OK || n < 1) return -1;
+    cfg->kind = unit ? WINDOW_TIME : WINDOW_COUNT;
+    cfg->size = unit ? (uint64_t)n * unit : (uint64_t)n;
+    return 0;
+}
+
+// Push every complete value in buf into the window. A value may be cut
+// by the end of a read, so the bytes after the last separator wait for
+// the next one; the number consumed is returned and *pushed counts the values.
+static size_t push_values(sliding_window *w, const char *buf, size_t len, uint64_t now_ns,
+                          long *pushed) {
+    const char *last = buf + len;
+    while (last > buf && !isspace((unsigned char)last[-1])) last--;
+
+    long values = 0, malformed = 0, dropped = 0;
+    const char *p = buf;
+    for (;;) {
+        while (p < last && isspace((unsigned char)*p)) p++;
+        if (p == last) break;
+        const char *token = p;
+        int value;
+        if (parse_int32(&p, last, 0, &value) != PARSE_OK) {
+            malformed++;
+            for (p = token; p < last && !isspace((unsigned char)*p); p++) {}
+        } else if (window_push(w, value, now_ns) == -1) {
+            dropped++;
+        } else {
+            values++;
+        }
+    }
+    atomic_fetch_add(&shared->values, values);
+    if (malformed) atomic_fetch_add(&shared->malformed, malformed);
+    if (dropped) atomic_fetch_add(&shared->dropped, dropped);
+    *pushed = values;
+    return (size_t)(last - buf);
+}
+
+// FIFO2 is only full when the report worker is stuck; the next report
+// supersedes this one anyway
+static void send_report(int fd, sliding_window *w) {
+    uint64_t now = monotonic_ns();
+    window_expire(w, now);
+    window_result res;
+    if (window_get(w, &res) == -1) return;  // Nothing arrived within a time window
+
+    trace_mark mark;
+    trace_begin(&mark, 0);
+    stream_report rep = { now, res.seen, res.max, res.min };
+    if (write(fd, &rep, sizeof(rep)) == (ssize_t)sizeof(rep)) {
+        atomic_fetch_add(&shared->reports, 1);
+    } else {
+        atomic_fetch_add(&shared->dropped, 1);
+    }
+    trace_end("emit", &mark, 0, 1);
+}
+
+// A restarted window worker starts over with an empty window
+static void window_worker(void) {
+    printf("Window worker started\n");
+    fflush(stdout);
+
+    int in = open(FIFO1, O_RDONLY | O_NONBLOCK);
+    int out = open(FIFO2, O_WRONLY | O_NONBLOCK);
+    sliding_window win;
+    if (in == -1 || out == -1 || window_init(&win, shared->cfg.kind, shared->cfg.size) == -1) {
+        printf("Error setting up the window worker: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    static char buf[STREAM_READ_BUF];
+    size_t have = 0;
+    long long next_emit = monotonic_ms() + shared->cfg.emit_ms;
+    while (!stop_requested) {
+        long long wait = next_emit - monotonic_ms();
+        if (wait > 0) {
+            struct pollfd pfd = { .fd = in, .events = POLLIN, .revents = 0 };
+            if (poll(&pfd, 1, (int)wait) == 0) trace_flush();
+        }
+
+        ssize_t n = read(in, buf + have, sizeof(buf) - have);
+        if (n > 0) {
+            trace_mark mark;
+            trace_begin(&mark, 1);
+            have += (size_t)n;
+            long pushed;
+            size_t used = push_values(&win, buf, have, monotonic_ns(), &pushed);
+            if (used == 0 && have == sizeof(buf)) {
+                atomic_fetch_add(&shared->malformed, 1);  // No separator in a whole buffer
+                used = have;
+            }
+            memmove(buf, buf + used, have - used);
+            have -= used;
+            trace_end("compute", &mark, 0, pushed);
+        } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+            printf("Error reading FIFO1: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        long long now = monotonic_ms();
+        if (now >= next_emit) {
+            send_report(out, &win);
+            next_emit += shared->cfg.emit_ms;
+            if (next_emit <= now) next_emit = now + shared->cfg.emit_ms;  // Fell behind; skip ticks
+        }
+    }
+    exit(EXIT_SUCCESS);  // SIGTERM in a profiling build
+}
+
+static void report_worker(void) {
+    printf("Report worker started\n");
+    fflush(stdout);
+
+    // The daemon holds a write end, so this neither blocks nor sees EOF
+    int in = open(FIFO2, O_RDONLY);
+    if (in == -1) {
+        printf("Error opening FIFO2 in the report worker: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const stream_config *cfg = &shared->cfg;
+    stream_report rep;
+    while (!stop_requested) {
+        size_t got = 0;
+        while (got < sizeof(rep)) {
+            ssize_t n = read(in, (char *)&rep + got, sizeof(rep) - got);
+            if (n > 0) {
+                got += (size_t)n;
+            } else if (n == 0 || errno != EINTR) {
+                printf("Error reading FIFO2: %s\n", n == 0 ? "closed" : strerror(errno));
+                exit(EXIT_FAILURE);
+            } else if (stop_requested) {
+                exit(EXIT_SUCCESS);  // SIGTERM in a profiling build
+            }
+        }
+        if (cfg->kind == WINDOW_TIME) {
+            printf("Window of last %llu ms: max %d min %d (%llu values so far)\n",
+                   (unsigned long long)(cfg->size / 1000000), rep.max, rep.min,
+                   (unsigned long long)rep.seen);
+        } else {
+            printf("Window of last %llu values: max %d min %d (%llu values so far)\n",
+                   (unsigned long long)cfg->size, rep.max, rep.min, (unsigned long long)rep.seen);
+        }
+        fflush(stdout);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+int run_stream_worker(const char *role, int index, int fd) {
+    shared = mmap(NULL, sizeof(stream_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        printf("Error mapping shared memory in %s worker: %s\n", role, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    instance_pin(&instance, index);
+    fault_process();
+    if (strcmp(role, role_names[STREAM_WINDOW]) == 0) {
+        trace_process("window worker");
+        window_worker();
+    } else if (strcmp(role, role_names[STREAM_REPORT]) == 0) {
+        trace_process("report worker");
+        report_worker();
+    }
+    printf("Unknown stream worker %s\n", role);
+    return EXIT_FAILURE;
+}
+
+static int spawn_stream_worker(int i) {
+    sigset_t chld_mask, old_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+
+    pid_t pid = start_worker(role_names[i], i, shared_fd, NULL);
+    if (pid == -1) {
+        fprintf(stderr, "Cannot start %s worker: %s\n", role_names[i], strerror(errno));
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        return -1;
+    }
+    workers[i] = pid;
+    if (track_child(pid, 1) == -1) {
+        fprintf(stderr, "Child table full, %s worker %d not tracked\n", role_names[i], pid);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+static void stop_stream_workers(void) {
+    for (int i = 0; i < STREAM_WORKERS; i++) {
+        if (workers[i] > 0 && !child_exited(workers[i])) kill(workers[i], SIGTERM);
+    }
+    for (int waited = 0; waited < 5; waited++) {
+        int alive = 0;
+        for (int i = 0; i < STREAM_WORKERS; i++) {
+            if (workers[i] > 0 && !child_exited(workers[i])) alive++;
+        }
+        if (alive == 0) return;
+        sleep(1);
+    }
+    for (int i = 0; i < STREAM_WORKERS; i++) {
+        if (workers[i] > 0 && !child_exited(workers[i])) kill(workers[i], SIGKILL);
+    }
+}
+
+static void print_stream_metrics(void) {
+    printf("Stream: %ld values, %ld malformed, %ld reports, %ld dropped\n",
+           atomic_load(&shared->values), atomic_load(&shared->malformed),
+           atomic_load(&shared->reports), atomic_load(&shared->dropped));
+    limits_report(stdout);
+    fflush(stdout);
+}
+
+static int setup_stream_shared(const stream_config *cfg) {
+    shared_fd = memfd_create("stream_shared", 0);
+    if (shared_fd == -1 || ftruncate(shared_fd, sizeof(stream_shared)) == -1) return -1;
+    shared = mmap(NULL, sizeof(stream_shared), PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+    if (shared == MAP_FAILED) {
+        shared = NULL;
+        return -1;
+    }
+    shared->cfg = *cfg;
+    atomic_init(&shared->values, 0);
+    atomic_init(&shared->malformed, 0);
+    atomic_init(&shared->reports, 0);
+    atomic_init(&shared->dropped, 0);
+    return 0;
+}
+
+int run_stream(const stream_config *cfg) {
+    serving = 1;
+
+    unlink(FIFO1);
+    unlink(FIFO2);
+    if (mkfifo(FIFO1, 0666) == -1 || mkfifo(FIFO2, 0600) == -1) {
+        fprintf(stderr, "mkfifo failed: %s\n", strerror(errno));
+        unlink(FIFO1);
+        return -1;
+    }
+
+    // Writers to FIFO1 come and go; holding both ends of both FIFOs keeps
+    // the workers from ever seeing EOF, also across a restart
+    int keep[4];
+    keep[0] = open(FIFO1, O_RDONLY | O_NONBLOCK);
+    keep[1] = open(FIFO1, O_WRONLY | O_NONBLOCK);
+    keep[2] = open(FIFO2, O_RDONLY | O_NONBLOCK);
+    keep[3] = open(FIFO2, O_WRONLY | O_NONBLOCK);
+    if (keep[0] == -1 || keep[1] == -1 || keep[2] == -1 || keep[3] == -1 ||
+        setup_stream_shared(cfg) == -1) {
+        fprintf(stderr, "Error setting up streaming mode: %s\n", strerror(errno));
+        unlink(FIFO1);
+        unlink(FIFO2);
+        return -1;
+    }
+
+    for (int i = 0; i < STREAM_WORKERS; i++) {
+        if (spawn_stream_worker(i) == -1) {
+            stop_stream_workers();
+            unlink(FIFO1);
+            unlink(FIFO2);
+            return -1;
+        }
+    }
+    printf("Streaming on %s: window of %llu %s, emitting every %d ms\n", FIFO1,
+           (unsigned long long)(cfg->kind == WINDOW_TIME ? cfg->size / 1000000 : cfg->size),
+           cfg->kind == WINDOW_TIME ? "ms" : "values", cfg->emit_ms);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        poll(NULL, 0, STREAM_SUPERVISE_MS);  // Cut short by signals
+        for (int i = 0; i < STREAM_WORKERS && !stop_requested; i++) {
+            if (child_exited(workers[i])) {
+                printf("Restarting %s worker (PID %d exited)\n", role_names[i], workers[i]);
+                spawn_stream_worker(i);
+            }
+        }
+        if (metrics_requested) {
+            metrics_requested = 0;
+            print_stream_metrics();
+        }
+        trace_flush();
+    }
+
+    stop_stream_workers();
+    print_stream_metrics();
+    trace_flush();
+    for (int i = 0; i < 4; i++) close(keep[i]);
+    unlink(FIFO1);
+    unlink(FIFO2);
+    printf("Stream exiting\n");
+    fflush(stdout);
+    return 0;
+}
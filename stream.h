@@ -0,0 +1,45 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include "window.h"
+
+// Streaming mode: instead of one pair, FIFO1 carries an unbounded stream
+// of decimal integers separated by whitespace, from any number of writers
+// that come and go (`vmstat -n 1 | awk ... > fifo1`). The window worker
+// replaces the compare stage: it keeps the running maximum and minimum of
+// a sliding window (window.h) over the stream and, every emit interval,
+// sends the current extremes over FIFO2 to the report worker, which logs
+// them. The daemon holds both ends of both FIFOs, restarts a worker that
+// dies and runs until SIGTERM; SIGUSR1 prints its counters.
+
+#define STREAM_DEFAULT_EMIT_MS 1000
+#define STREAM_READ_BUF 65536        // Bytes taken from FIFO1 per read
+#define STREAM_SUPERVISE_MS 1000
+
+typedef struct {
+    window_kind kind;
+    uint64_t size;    // Values, or nanoseconds for WINDOW_TIME
+    int emit_ms;      // Window results are sent this often
+} stream_config;
+
+// One window result, FIFO2 from the window worker to the report worker
+typedef struct {
+    uint64_t ns;      // CLOCK_MONOTONIC when taken
+    uint64_t seen;    // Values in the stream so far
+    int32_t max;
+    int32_t min;
+} stream_report;
+
+// "<n>" for the last n values, "<n>ms" or "<n>s" for a time span. Returns
+// 0, or -1 for anything else.
+int stream_parse_window(const char *spec, stream_config *cfg);
+
+// Run streaming mode inside the daemon until SIGTERM
+int run_stream(const stream_config *cfg);
+
+// Body of the window or report worker started by run_stream; fd is the
+// shared state it maps. Returns only on failure.
+int run_stream_worker(const char *role, int index, int fd);
+
+#endif
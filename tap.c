@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "instance.h"
+#include "ring.h"
+#include "parse_int.h"
+
+// Subscriber of a running server's result ring (ring.h). It follows the
+// stream of results at its own pace without taking any from the clients
+// or from other subscribers, as a printer, an archiver or a metrics sink.
+
+#define TAP_LATENCY_BUCKETS 64   // Powers of two of nanoseconds
+
+typedef enum { TAP_PRINT, TAP_ARCHIVE, TAP_METRICS } tap_mode;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-i name] [-m print|archive|metrics] [-o file] [-P drop|block] "
+            "[-n count] [-t seconds] [-r seconds] [-S us]\n", prog);
+    fprintf(stderr, "  -i name     daemon instance (default: the unnamed one)\n");
+    fprintf(stderr, "  -m mode     print each result (default), archive raw records to -o, or\n");
+    fprintf(stderr, "              report rate and publish-to-read latency every -r seconds\n");
+    fprintf(stderr, "  -P policy   when a ring behind: drop records (default) or hold producers\n");
+    fprintf(stderr, "              back for up to %d ms\n", RING_BLOCK_MS);
+    fprintf(stderr, "  -n count    stop after count records\n");
+    fprintf(stderr, "  -t seconds  stop after this long\n");
+    fprintf(stderr, "  -S us       spend us on every record, to play a slow subscriber\n");
+}
+
+static int parse_arg(const char *arg) {
+    int value;
+    int rc = parse_int_arg(arg, &value);
+    if (rc != PARSE_OK || value < 0) {
+        fprintf(stderr, "Invalid number '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+    long records;
+    long cached;
+    long lost;
+    long hist[TAP_LATENCY_BUCKETS];
+} tap_interval;
+
+// Upper bound of the bucket holding the given share of the samples
+static double percentile_us(const tap_interval *iv, double share) {
+    long want = (long)(iv->records * share), seen = 0;
+    for (int b = 0; b < TAP_LATENCY_BUCKETS; b++) {
+        seen += iv->hist[b];
+        if (seen > want) return (double)(1ull << b) / 1e3;
+    }
+    return 0.0;
+}
+
+static void report(const tap_interval *iv, double seconds) {
+    printf("%8.0f rec/s  cached %5.1f%%  lost %ld  latency p50 < %.1f us  p99 < %.1f us\n",
+           iv->records / seconds, iv->records ? 100.0 * iv->cached / iv->records : 0.0,
+           iv->lost, percentile_us(iv, 0.5), percentile_us(iv, 0.99));
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    daemon_instance inst;
+    tap_mode mode = TAP_PRINT;
+    ring_policy policy = RING_DROP;
+    const char *archive_path = NULL;
+    long limit = -1;
+    int seconds = 0, interval = 1, work_us = 0;
+    int opt;
+
+    instance_init(&inst, NULL);
+    while ((opt = getopt(argc, argv, "i:m:o:P:n:t:r:S:")) != -1) {
+        switch (opt) {
+            case 'i':
+                if (instance_init(&inst, optarg) == -1) {
+                    fprintf(stderr, "Invalid instance name '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "print") == 0) {
+                    mode = TAP_PRINT;
+                } else if (strcmp(optarg, "archive") == 0) {
+                    mode = TAP_ARCHIVE;
+                } else if (strcmp(optarg, "metrics") == 0) {
+                    mode = TAP_METRICS;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                archive_path = optarg;
+                break;
+            case 'P':
+                if (strcmp(optarg, "drop") == 0) {
+                    policy = RING_DROP;
+                } else if (strcmp(optarg, "block") == 0) {
+                    policy = RING_BLOCK;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                limit = parse_arg(optarg);
+                break;
+            case 't':
+                seconds = parse_arg(optarg);
+                break;
+            case 'r':
+                interval = parse_arg(optarg);
+                if (interval < 1) interval = 1;
+                break;
+            case 'S':
+                work_us = parse_arg(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || (mode == TAP_ARCHIVE) != (archive_path != NULL)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *archive = NULL;
+    if (archive_path && (archive = fopen(archive_path, "wb")) == NULL) {
+        perror(archive_path);
+        return EXIT_FAILURE;
+    }
+    result_ring *ring = ring_open(inst.ring);
+    if (ring == NULL) {
+        fprintf(stderr, "No result ring %s: is the server running?\n", inst.ring);
+        return EXIT_FAILURE;
+    }
+    int sub = ring_subscribe(ring, policy);
+    if (sub == -1) {
+        fprintf(stderr, "All %d subscriber slots are taken\n", RING_MAX_SUBSCRIBERS);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa;
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct timespec work = { 0, (long)work_us * 1000 };
+    uint64_t start = now_ns(), last_report = start;
+    uint64_t end = seconds > 0 ? start + (uint64_t)seconds * 1000000000ull : 0;
+    long total = 0, total_lost = 0;
+    tap_interval iv;
+    memset(&iv, 0, sizeof(iv));
+
+    while (!stopping && total != limit) {
+        const ring_record *rec = ring_next(ring, sub, 100, &iv.lost);
+        uint64_t now = now_ns();
+        if (rec != NULL) {
+            ring_record copy = *rec;
+            if (work_us > 0) nanosleep(&work, NULL);
+            if (ring_release(ring, sub, &iv.lost)) {
+                total++;
+                iv.records++;
+                if (copy.flags & RING_CACHED) iv.cached++;
+                uint64_t waited = now > copy.ns ? now - copy.ns : 0;
+                int bucket = 0;
+                while (bucket < TAP_LATENCY_BUCKETS - 1 && (1ull << bucket) < waited) bucket++;
+                iv.hist[bucket]++;
+
+                if (mode == TAP_PRINT) {
+                    printf("Request %u from %d: larger of %d and %d is %d%s\n", copy.request_id,
+                           (int)copy.client, copy.nums[0], copy.nums[1], copy.larger,
+                           copy.flags & RING_CACHED ? " (cached)" : "");
+                } else if (mode == TAP_ARCHIVE && fwrite(&copy, sizeof(copy), 1, archive) != 1) {
+                    perror(archive_path);
+                    break;
+                }
+            }
+        }
+        if (mode == TAP_METRICS && now - last_report >= (uint64_t)interval * 1000000000ull) {
+            report(&iv, (now - last_report) / 1e9);
+            total_lost += iv.lost;
+            memset(&iv, 0, sizeof(iv));
+            last_report = now;
+        }
+        if (end && now >= end) break;
+    }
+    total_lost += iv.lost;
+
+    ring_unsubscribe(ring, sub);
+    ring_close(ring);
+    if (archive && fclose(archive) != 0) perror(archive_path);
+    fprintf(stderr, "%ld records read, %ld lost\n", total, total_lost);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "trace.h"
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_defs[TRACE_COUNTERS] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int trace_fd = -1;
+static int want_counters = 0;
+static int pid;
+static char buf[TRACE_BUFFER];
+static size_t used;
+
+// Counters of this process, opened as one group so a single read returns
+// them all. slot[i] is the position of counter i in the group, -1 if the
+// kernel refused it (no PMU in a VM, perf_event_paranoid).
+static int group_fd = -1;
+static int n_open;
+static int slot[TRACE_COUNTERS];
+static int counter_fds[TRACE_COUNTERS];
+
+// A forked child inherits the parent's descriptors, which keep counting
+// the parent; an exec'd one does not get them at all (close-on-exec)
+static void close_counters(void) {
+    for (int i = 0; i < n_open; i++) close(counter_fds[i]);
+    group_fd = -1;
+    n_open = 0;
+}
+
+static void open_counters(void) {
+    close_counters();
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_defs[i].type;
+        attr.config = counter_defs[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = attr.type == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+        slot[i] = -1;
+        if (fd == -1) continue;
+        if (group_fd == -1) group_fd = fd;
+        counter_fds[n_open] = fd;
+        slot[i] = n_open++;
+    }
+}
+
+static int read_counters(uint64_t counts[TRACE_COUNTERS]) {
+    uint64_t values[1 + TRACE_COUNTERS];
+    if (group_fd == -1 || read(group_fd, values, sizeof(values)) == -1) return 0;
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        counts[i] = slot[i] == -1 ? 0 : values[1 + slot[i]];
+    }
+    return 1;
+}
+
+static void append(const char *event, int len) {
+    if (len <= 0 || (size_t)len >= sizeof(buf)) return;
+    if (used + (size_t)len > sizeof(buf)) trace_flush();
+    memcpy(buf + used, event, (size_t)len);
+    used += (size_t)len;
+}
+
+int trace_open(const char *path, int counters) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (trace_fd == -1) return -1;
+    // JSON array format; the viewers accept it without the closing bracket,
+    // so processes can keep appending until they die
+    if (write(trace_fd, "[\n", 2) != 2) {
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+    want_counters = counters;
+    trace_process("daemon");
+    return 0;
+}
+
+int trace_descriptor(int *counters) {
+    *counters = want_counters;
+    return trace_fd;
+}
+
+void trace_attach(int fd, int counters) {
+    trace_fd = fd;
+    want_counters = counters;
+}
+
+void trace_process(const char *name) {
+    if (trace_fd == -1) return;
+    pid = (int)getpid();
+    used = 0;
+    if (want_counters) open_counters();
+
+    char event[160];
+    append(event, snprintf(event, sizeof(event),
+                           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}},\n",
+                           pid, name, pid));
+}
+
+int trace_enabled(void) {
+    return trace_fd != -1;
+}
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void trace_begin(trace_mark *m, int counted) {
+    m->counted = counted && want_counters && read_counters(m->counts);
+    m->ns = trace_now();
+}
+
+// Timestamps go out in microseconds, the unit of the format, with three
+// decimals so no nanosecond is lost
+static int format_span(char *event, size_t len, const char *stage, uint64_t start_ns,
+                       uint64_t end_ns, uint32_t id) {
+    if (end_ns < start_ns) end_ns = start_ns;
+    return snprintf(event, len,
+                    "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"id\":%u",
+                    stage, (unsigned long long)(start_ns / 1000), (unsigned)(start_ns % 1000),
+                    (unsigned long long)((end_ns - start_ns) / 1000),
+                    (unsigned)((end_ns - start_ns) % 1000), pid, pid, id);
+}
+
+void trace_end(const char *stage, const trace_mark *begin, uint32_t id, long count) {
+    if (trace_fd == -1) return;
+    uint64_t counts[TRACE_COUNTERS];
+    int counted = begin->counted && read_counters(counts);
+    uint64_t end_ns = trace_now();
+
+    char event[512];
+    int len = format_span(event, sizeof(event), stage, begin->ns, end_ns, id);
+    if (count > 0) {
+        len += snprintf(event + len, sizeof(event) - (size_t)len, ",\"count\":%ld", count);
+    }
+    for (int i = 0; counted && i < TRACE_COUNTERS; i++) {
+        if (slot[i] == -1) continue;
+        len += snprintf(event + len, sizeof(event) - (size_t)len, ",\"%s\":%llu",
+                        counter_defs[i].name, (unsigned long long)(counts[i] - begin->counts[i]));
+    }
+    len += snprintf(event + len, sizeof(event) - (size_t)len, "}},\n");
+    append(event, len);
+}
+
+void trace_span(const char *stage, uint64_t start_ns, uint64_t end_ns, uint32_t id) {
+    if (trace_fd == -1) return;
+    char event[256];
+    int len = format_span(event, sizeof(event), stage, start_ns, end_ns, id);
+    len += snprintf(event + len, sizeof(event) - (size_t)len, "}},\n");
+    append(event, len);
+}
+
+void trace_flush(void) {
+    if (trace_fd == -1 || used == 0) return;
+    // O_APPEND keeps each process's batch whole next to the others'
+    if (write(trace_fd, buf, used) == -1) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    used = 0;
+}
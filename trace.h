@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Optional stage tracing (-t <file>). Every process of the daemon records
+// spans stamped with CLOCK_MONOTONIC nanoseconds, which all processes
+// share, into a private buffer and appends it to one file in the Chrome
+// trace event format; chrome://tracing and ui.perfetto.dev load it as is.
+// With -T the batch-level spans also carry the deltas of this process's
+// hardware counters read through perf_event_open.
+
+#define TRACE_BUFFER 65536  // Bytes of events a process buffers between appends
+
+enum {
+    TRACE_CYCLES,
+    TRACE_INSTRUCTIONS,
+    TRACE_CACHE_MISSES,
+    TRACE_CONTEXT_SWITCHES,
+    TRACE_COUNTERS
+};
+
+// Start of a span: a timestamp plus, for counted spans, a counter snapshot
+typedef struct {
+    uint64_t ns;
+    uint64_t counts[TRACE_COUNTERS];
+    int counted;
+} trace_mark;
+
+// In the daemon, after it detached and before it forks: create the file.
+// Returns 0, or -1 when it cannot be written (tracing stays off).
+int trace_open(const char *path, int counters);
+
+// Descriptor and counter setting of an open trace, for a worker started
+// by exec to pass to trace_attach. -1 when tracing is off.
+int trace_descriptor(int *counters);
+
+// In a worker started by exec: append to the inherited descriptor
+void trace_attach(int fd, int counters);
+
+// In every process right after fork or trace_attach: drop the parent's buffered events,
+// name the process in the viewer and open its own counters
+void trace_process(const char *name);
+
+int trace_enabled(void);
+uint64_t trace_now(void);
+
+// Mark the start of a span; `counted` reads the counters as well, which
+// costs a system call and is meant for spans around whole batches
+void trace_begin(trace_mark *m, int counted);
+
+// Record a span from `begin` to now. id is the request ID (0 for batch
+// spans) and count the number of items it covered (0 to leave it out).
+void trace_end(const char *stage, const trace_mark *begin, uint32_t id, long count);
+
+// Record a span whose endpoints were stamped elsewhere, possibly by
+// another process
+void trace_span(const char *stage, uint64_t start_ns, uint64_t end_ns, uint32_t id);
+
+// Append the buffered events to the file
+void trace_flush(void);
+
+#endif
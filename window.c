@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "window.h"
+
+#define WINDOW_INITIAL_CAP 64
+
+static int deque_init(window_deque *d) {
+    d->items = malloc(WINDOW_INITIAL_CAP * sizeof(*d->items));
+    d->cap = WINDOW_INITIAL_CAP;
+    d->head = 0;
+    d->count = 0;
+    return d->items == NULL ? -1 : 0;
+}
+
+// A count window never holds more than size entries, but a time window
+// holds as many as arrive within its span, so both grow on demand
+static int deque_reserve(window_deque *d) {
+    if (d->count < d->cap) return 0;
+    window_entry *grown = malloc(2 * d->cap * sizeof(*grown));
+    if (grown == NULL) return -1;
+    size_t first = d->cap - d->head;  // Entries up to the end of the old buffer
+    memcpy(grown, d->items + d->head, first * sizeof(*grown));
+    memcpy(grown + first, d->items, d->head * sizeof(*grown));
+    free(d->items);
+    d->items = grown;
+    d->cap *= 2;
+    d->head = 0;
+    return 0;
+}
+
+static window_entry *deque_front(const window_deque *d) {
+    return &d->items[d->head];
+}
+
+static window_entry *deque_back(const window_deque *d) {
+    return &d->items[(d->head + d->count - 1) & (d->cap - 1)];
+}
+
+static void deque_push_back(window_deque *d, const window_entry *e) {
+    d->items[(d->head + d->count) & (d->cap - 1)] = *e;
+    d->count++;
+}
+
+static void deque_pop_front(window_deque *d) {
+    d->head = (d->head + 1) & (d->cap - 1);
+    d->count--;
+}
+
+int window_init(sliding_window *w, window_kind kind, uint64_t size) {
+    memset(w, 0, sizeof(*w));
+    w->kind = kind;
+    w->size = size > 0 ? size : 1;
+    if (deque_init(&w->max) == -1 || deque_init(&w->min) == -1) {
+        window_destroy(w);
+        return -1;
+    }
+    return 0;
+}
+
+void window_destroy(sliding_window *w) {
+    free(w->max.items);
+    free(w->min.items);
+    w->max.items = w->min.items = NULL;
+}
+
+int window_push(sliding_window *w, int32_t value, uint64_t now_ns) {
+    // Room first, so a failed allocation leaves the window as it was
+    if (deque_reserve(&w->max) == -1 || deque_reserve(&w->min) == -1) return -1;
+
+    window_entry e = { value, w->seen++, now_ns };
+    // Ties go too: the newer equal value stays in the window longer
+    while (w->max.count > 0 && deque_back(&w->max)->value <= value) w->max.count--;
+    while (w->min.count > 0 && deque_back(&w->min)->value >= value) w->min.count--;
+    deque_push_back(&w->max, &e);
+    deque_push_back(&w->min, &e);
+
+    if (w->kind == WINDOW_TIME) {
+        window_expire(w, now_ns);
+    } else {
+        while (e.seq - deque_front(&w->max)->seq >= w->size) deque_pop_front(&w->max);
+        while (e.seq - deque_front(&w->min)->seq >= w->size) deque_pop_front(&w->min);
+    }
+    return 0;
+}
+
+void window_expire(sliding_window *w, uint64_t now_ns) {
+    if (w->kind != WINDOW_TIME) return;
+    while (w->max.count > 0 && now_ns - deque_front(&w->max)->ns >= w->size) deque_pop_front(&w->max);
+    while (w->min.count > 0 && now_ns - deque_front(&w->min)->ns >= w->size) deque_pop_front(&w->min);
+}
+
+int window_get(const sliding_window *w, window_result *out) {
+    // The newest value is at the back of both deques, so they empty together
+    if (w->max.count == 0) return -1;
+    out->max = deque_front(&w->max)->value;
+    out->min = deque_front(&w->min)->value;
+    out->seen = w->seen;
+    return 0;
+}
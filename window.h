@@ -0,0 +1,61 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Running maximum and minimum over a sliding window of a value stream,
+// either the last N values or the values of the last N milliseconds. Each
+// extreme is kept in a monotonic deque: a new value first removes from the
+// back every value it dominates, since those can never be the extreme
+// again, and values leave the front once they fall out of the window. Every
+// value enters and leaves each deque once, so a push costs O(1) amortized
+// and the extremes are always at the fronts.
+
+typedef enum { WINDOW_COUNT, WINDOW_TIME } window_kind;
+
+typedef struct {
+    int32_t value;
+    uint64_t seq;   // Position in the stream
+    uint64_t ns;    // When it arrived
+} window_entry;
+
+// Ring buffer, grown by doubling; a power of two in size
+typedef struct {
+    window_entry *items;
+    size_t cap;
+    size_t head;
+    size_t count;
+} window_deque;
+
+typedef struct {
+    window_kind kind;
+    uint64_t size;     // Values, or nanoseconds for WINDOW_TIME
+    uint64_t seen;     // Values pushed so far
+    window_deque max;  // Decreasing from the front
+    window_deque min;  // Increasing from the front
+} sliding_window;
+
+typedef struct {
+    int32_t max;
+    int32_t min;
+    uint64_t seen;
+} window_result;
+
+// size is a value count or a span in nanoseconds, at least 1. Returns 0,
+// or -1 when out of memory.
+int window_init(sliding_window *w, window_kind kind, uint64_t size);
+void window_destroy(sliding_window *w);
+
+// Add a value that arrived at now_ns (CLOCK_MONOTONIC, never decreasing).
+// Returns 0, or -1 when out of memory; the window is unchanged then.
+int window_push(sliding_window *w, int32_t value, uint64_t now_ns);
+
+// Drop what a time window no longer covers at now_ns, with or without new
+// input. Count windows only shrink on push.
+void window_expire(sliding_window *w, uint64_t now_ns);
+
+// Extremes of the window. Returns 0, or -1 when it holds no value.
+int window_get(const sliding_window *w, window_result *out);
+
+#endif
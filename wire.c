@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include "wire.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint32_t frame_checksum(const wire_header *hdr, const void *payload) {
+    wire_header copy = *hdr;
+    copy.checksum = 0;
+    uint32_t h = fnv1a(FNV_OFFSET, &copy, sizeof(copy));
+    return fnv1a(h, payload, hdr->length);
+}
+
+void wire_header_init(wire_header *hdr, uint8_t opcode, uint32_t request_id,
+                      uint32_t client, const void *payload, uint32_t length) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = WIRE_MAGIC;
+    hdr->version = WIRE_VERSION;
+    hdr->opcode = opcode;
+    hdr->request_id = request_id;
+    hdr->client = client;
+    hdr->length = length;
+    wire_header_seal(hdr, payload);
+}
+
+void wire_header_seal(wire_header *hdr, const void *payload) {
+    hdr->checksum = frame_checksum(hdr, payload);
+}
+
+uint64_t wire_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int wire_expired(uint64_t deadline_ns, uint64_t now_ns) {
+    return deadline_ns != 0 && now_ns >= deadline_ns;
+}
+
+int wire_checksum_ok(const wire_header *hdr, const void *payload) {
+    return hdr->checksum == frame_checksum(hdr, payload);
+}
+
+int wire_priority(const wire_header *hdr) {
+    int prio = hdr->flags & WIRE_FLAG_PRIO_MASK;
+    return prio < WIRE_PRIORITIES ? prio : WIRE_PRIO_BULK;
+}
+
+int wire_reader_init(wire_reader *r, int fd, size_t cap) {
+    // Room for at least two frames so a complete one always fits
+    if (cap < 2 * (sizeof(wire_header) + WIRE_MAX_PAYLOAD)) {
+        cap = 2 * (sizeof(wire_header) + WIRE_MAX_PAYLOAD);
+    }
+    r->buf = malloc(cap);
+    if (r->buf == NULL) return -1;
+    r->fd = fd;
+    r->cap = cap;
+    r->start = r->end = 0;
+    r->frame = 0;
+    r->skipped = 0;
+    return 0;
+}
+
+void wire_reader_destroy(wire_reader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+ssize_t wire_reader_fill(wire_reader *r) {
+    if (r->start > 0 && r->end == r->cap) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->cap) {
+        errno = ENOBUFS;  // A whole unconsumed buffer; caller must peek first
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+        if (n == -1 && errno == EINTR) continue;
+        if (n > 0) r->end += (size_t)n;
+        return n;
+    }
+}
+
+static int header_valid(const wire_header *hdr) {
+    return hdr->magic == WIRE_MAGIC && hdr->version == WIRE_VERSION &&
+           hdr->length <= WIRE_MAX_PAYLOAD;
+}
+
+// 1 when a whole frame with a good checksum starts at offset at of the
+// buffer, 0 when its header is plausible but the rest has not arrived,
+// -1 when it is not a frame
+static int frame_at(const wire_reader *r, size_t at, wire_header *hdr) {
+    size_t avail = r->end - at;
+    if (avail < sizeof(*hdr)) return 0;
+    memcpy(hdr, r->buf + at, sizeof(*hdr));
+    if (!header_valid(hdr)) return -1;
+    if (avail < sizeof(*hdr) + hdr->length) return 0;
+    return wire_checksum_ok(hdr, r->buf + at + sizeof(*hdr)) ? 1 : -1;
+}
+
+// Drop skip bytes and let the caller count the damage before trying again
+static int resync(wire_reader *r, size_t skip) {
+    r->start += skip;
+    r->skipped += (long)skip;
+    return -1;
+}
+
+int wire_reader_peek(wire_reader *r, wire_header *hdr, const void **payload) {
+    const uint16_t magic = WIRE_MAGIC;
+    const unsigned char first = *(const unsigned char *)&magic;
+    size_t avail = r->end - r->start;
+    if (avail < sizeof(*hdr)) return 0;
+
+    int rc = frame_at(r, r->start, hdr);
+    if (rc == -1) {
+        // Garbage, or a frame whose checksum does not match: nothing in
+        // it can be trusted, so move on to the next possible magic number
+        size_t skip = 1;
+        while (skip < avail && r->buf[r->start + skip] != first) skip++;
+        return resync(r, skip);
+    }
+    if (rc == 0) {
+        // Either the rest is on its way, or this is a torn header whose
+        // length swallows the frames behind it. A complete frame inside
+        // the bytes it claims settles it.
+        wire_header next;
+        for (size_t at = r->start + 1; at + sizeof(next) <= r->end; at++) {
+            if (r->buf[at] == first && frame_at(r, at, &next) == 1) return resync(r, at - r->start);
+        }
+        return 0;
+    }
+
+    *payload = r->buf + r->start + sizeof(*hdr);
+    r->frame = sizeof(*hdr) + hdr->length;
+    return 1;
+}
+
+void wire_reader_consume(wire_reader *r) {
+    r->start += r->frame;
+    r->frame = 0;
+    if (r->start == r->end) r->start = r->end = 0;
+}
+
+void wire_writer_init(wire_writer *w, int fd, int atomic) {
+    w->fd = fd;
+    w->atomic = atomic;
+    wire_writer_reset(w);
+}
+
+void wire_writer_reset(wire_writer *w) {
+    w->n_frames = 0;
+    w->n_iov = 0;
+    w->first_iov = 0;
+    w->arena_used = 0;
+}
+
+int wire_writer_pending(const wire_writer *w) {
+    return w->first_iov < w->n_iov;
+}
+
+int wire_writer_append(wire_writer *w, const wire_header *hdr, const void *payload) {
+    // A batch only grows until its first write; after that it must drain
+    if (w->first_iov > 0 || w->n_frames == WIRE_WRITER_FRAMES ||
+        w->arena_used + hdr->length > WIRE_WRITER_ARENA) {
+        return -1;
+    }
+
+    int f = w->n_frames++;
+    w->hdrs[f] = *hdr;
+    w->frame_bytes[f] = sizeof(*hdr) + hdr->length;
+    w->iov[w->n_iov].iov_base = &w->hdrs[f];
+    w->iov[w->n_iov].iov_len = sizeof(*hdr);
+    w->iov_frame[w->n_iov++] = f;
+
+    if (hdr->length > 0) {
+        unsigned char *copy = w->arena + w->arena_used;
+        memcpy(copy, payload, hdr->length);
+        w->arena_used += hdr->length;
+        w->iov[w->n_iov].iov_base = copy;
+        w->iov[w->n_iov].iov_len = hdr->length;
+        w->iov_frame[w->n_iov++] = f;
+    }
+    return 0;
+}
+
+// Iovecs from first_iov that make up whole frames within PIPE_BUF bytes
+static int atomic_span(const wire_writer *w) {
+    int f = w->iov_frame[w->first_iov];
+    size_t bytes = w->frame_bytes[f];
+    int end = w->first_iov;
+    for (;;) {
+        while (end < w->n_iov && w->iov_frame[end] == f) end++;
+        if (end == w->n_iov) break;
+        f = w->iov_frame[end];
+        if (bytes + w->frame_bytes[f] > PIPE_BUF) break;
+        bytes += w->frame_bytes[f];
+    }
+    return end - w->first_iov;
+}
+
+int wire_writer_flush(wire_writer *w) {
+    while (w->first_iov < w->n_iov) {
+        int count = w->atomic ? atomic_span(w) : w->n_iov - w->first_iov;
+        ssize_t n = writev(w->fd, &w->iov[w->first_iov], count);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // Only non-atomic writers can see a short write; resume mid-iovec
+        size_t left = (size_t)n;
+        while (left > 0 && left >= w->iov[w->first_iov].iov_len) {
+            left -= w->iov[w->first_iov].iov_len;
+            w->first_iov++;
+        }
+        if (left > 0) {
+            w->iov[w->first_iov].iov_base = (char *)w->iov[w->first_iov].iov_base + left;
+            w->iov[w->first_iov].iov_len -= left;
+        }
+    }
+    wire_writer_reset(w);
+    return 0;
+}
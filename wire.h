@@ -0,0 +1,141 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Framed binary protocol spoken on every server FIFO. Each frame is a
+// fixed header followed by `length` payload bytes. Integers are in host
+// byte order: both ends always run on the same machine.
+
+#define WIRE_MAGIC 0xD1F0
+#define WIRE_VERSION 1
+
+enum {
+    WIRE_OP_COMPARE = 1,  // Payload: wire_compare
+    WIRE_OP_RESULT = 2,   // Payload: wire_result
+    WIRE_OP_ERROR = 3     // No payload, reason in status
+};
+
+enum {
+    WIRE_STATUS_OK = 0,
+    WIRE_STATUS_BAD_FRAME,    // Checksum mismatch or malformed header
+    WIRE_STATUS_BAD_OPCODE,
+    WIRE_STATUS_BAD_LENGTH,   // Payload size does not fit the opcode
+    WIRE_STATUS_RETRY         // Server gave up on the request; send it again
+};
+
+// Request priority travels in the low bits of flags. Interactive requests
+// are dispatched first; bulk ones fill in behind them and are aged so they
+// are never starved.
+enum {
+    WIRE_PRIO_INTERACTIVE = 0,
+    WIRE_PRIO_BULK = 1,
+    WIRE_PRIORITIES
+};
+#define WIRE_FLAG_PRIO_MASK 0x0003
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t flags;        // WIRE_FLAG_*
+    uint16_t status;       // WIRE_STATUS_* on results and errors
+    uint32_t request_id;   // Chosen by the client, echoed in the answer
+    uint32_t client;       // Client PID, selects the reply FIFO
+    uint32_t length;       // Payload bytes after the header
+    uint32_t checksum;     // FNV-1a over header (this field zero) and payload
+    uint64_t deadline_ns;  // wire_now_ns() after which the answer is useless, 0: none
+} wire_header;
+
+typedef struct {
+    int32_t nums[2];
+} wire_compare;
+
+typedef struct {
+    int32_t larger;
+} wire_result;
+
+// Largest frame accepted; anything bigger is treated as garbage. Frames on
+// a FIFO shared by several writers must also fit in one atomic pipe write.
+#define WIRE_MAX_PAYLOAD 256
+
+// Fill in a header and its checksum for the given payload
+void wire_header_init(wire_header *hdr, uint8_t opcode, uint32_t request_id,
+                      uint32_t client, const void *payload, uint32_t length);
+// Recompute the checksum after changing header fields such as status
+void wire_header_seal(wire_header *hdr, const void *payload);
+int wire_checksum_ok(const wire_header *hdr, const void *payload);
+
+// Priority class of a request; unknown classes count as bulk
+int wire_priority(const wire_header *hdr);
+
+// Deadlines are CLOCK_MONOTONIC nanoseconds, one clock for every process on
+// the machine. Each stage drops a request whose deadline passed instead of
+// working on it; the client gives up on it at the same moment.
+uint64_t wire_now_ns(void);
+int wire_expired(uint64_t deadline_ns, uint64_t now_ns);
+
+// Incremental frame reader over a (usually non-blocking) descriptor;
+// frames split across reads are reassembled.
+typedef struct {
+    int fd;
+    unsigned char *buf;
+    size_t cap;
+    size_t start;   // First unconsumed byte
+    size_t end;     // One past the last byte read
+    size_t frame;   // Size of the frame returned by the last peek
+    long skipped;   // Bytes thrown away while resynchronizing
+} wire_reader;
+
+int wire_reader_init(wire_reader *r, int fd, size_t cap);
+void wire_reader_destroy(wire_reader *r);
+
+// Read whatever is available. Returns bytes read, 0 on EOF, -1 on error
+// (EAGAIN when nothing is there yet).
+ssize_t wire_reader_fill(wire_reader *r);
+
+// Look at the next complete frame without consuming it. Returns 1 with
+// hdr/payload set and the checksum verified, 0 when more bytes are needed,
+// -1 after skipping garbage or a frame that failed its checksum; the
+// fields of such a frame are never acted on.
+int wire_reader_peek(wire_reader *r, wire_header *hdr, const void **payload);
+void wire_reader_consume(wire_reader *r);
+
+// Batches frames into iovecs written with writev(). In atomic mode every
+// writev carries whole frames and at most PIPE_BUF bytes, so frames from
+// several processes sharing a FIFO never interleave.
+#define WIRE_WRITER_FRAMES 64
+#define WIRE_WRITER_ARENA 4096      // Payload bytes one batch can hold
+
+typedef struct {
+    int fd;
+    int atomic;
+    wire_header hdrs[WIRE_WRITER_FRAMES];
+    size_t frame_bytes[WIRE_WRITER_FRAMES];
+    unsigned char arena[WIRE_WRITER_ARENA];  // Payload copies
+    size_t arena_used;
+    struct iovec iov[2 * WIRE_WRITER_FRAMES];
+    int iov_frame[2 * WIRE_WRITER_FRAMES];   // Frame each iovec belongs to
+    int n_frames;
+    int n_iov;
+    int first_iov;                           // Everything before it is written
+} wire_writer;
+
+void wire_writer_init(wire_writer *w, int fd, int atomic);
+
+// Queue one frame (header and payload are copied, checksum already set).
+// Returns -1 when the batch is full; flush and retry.
+int wire_writer_append(wire_writer *w, const wire_header *hdr, const void *payload);
+
+// Write queued frames. Returns 0 when everything went out, -1 with errno
+// set otherwise (EAGAIN: retry once the fd is writable).
+int wire_writer_flush(wire_writer *w);
+int wire_writer_pending(const wire_writer *w);
+
+// Drop everything queued, e.g. after the peer went away
+void wire_writer_reset(wire_writer *w);
+
+#endif
@@ -0,0 +1,42 @@
+#include "ws_deque.h"
+
+void ws_deque_init(ws_deque *dq) {
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    atomic_init(&dq->sleeping, 0);
+}
+
+int ws_deque_push(ws_deque *dq, const ws_task *task) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if (b - t >= WS_DEQUE_CAPACITY) return -1;
+
+    // Slot b was last used by task b - CAPACITY, which has been taken
+    dq->tasks[b & (WS_DEQUE_CAPACITY - 1)] = *task;
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+    return 0;
+}
+
+int ws_deque_take(ws_deque *dq, ws_task *task) {
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    for (;;) {
+        long long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+        if (t >= b) return -1;
+
+        // The copy may race with the producer refilling the slot, but only
+        // after someone else took index t; our CAS then fails and we retry
+        ws_task copy = dq->tasks[t & (WS_DEQUE_CAPACITY - 1)];
+        if (atomic_compare_exchange_weak_explicit(&dq->top, &t, t + 1,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            *task = copy;
+            return 0;
+        }
+    }
+}
+
+long ws_deque_size(ws_deque *dq) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    return b > t ? (long)(b - t) : 0;
+}
@@ -0,0 +1,33 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stdatomic.h>
+#include "server.h"
+
+#define WS_DEQUE_CAPACITY 1024  // Tasks per worker, power of two
+#define WS_CACHE_LINE 64
+
+typedef serve_request ws_task;
+
+// Per-worker task deque living in shared memory. The dispatcher is the only
+// producer and appends at `bottom`; the owning worker and thieves both take
+// from `top` with a CAS, so no locks are needed between processes.
+typedef struct {
+    _Alignas(WS_CACHE_LINE) atomic_llong top;
+    _Alignas(WS_CACHE_LINE) atomic_llong bottom;
+    _Alignas(WS_CACHE_LINE) atomic_int sleeping;  // Owner is parked on its doorbell
+    ws_task tasks[WS_DEQUE_CAPACITY];
+} ws_deque;
+
+void ws_deque_init(ws_deque *dq);
+
+// Producer side. Returns 0, or -1 when the deque is full.
+int ws_deque_push(ws_deque *dq, const ws_task *task);
+
+// Consumer side, safe from any process. Returns 0 with a task, -1 if empty.
+int ws_deque_take(ws_deque *dq, ws_task *task);
+
+// Tasks currently queued (a snapshot, may be stale immediately)
+long ws_deque_size(ws_deque *dq);
+
+#endif